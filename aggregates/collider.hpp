@@ -1,12 +1,18 @@
 #pragma once
 #include "../commands.hpp"
-#include "../common/qtree.hpp"
+#include "../common/flat_qtree.hpp"
 #include "../common/units.hpp"
 #include "entity.hpp"
 #include "time.hpp"
+#include <event-sauce/scheduler/fork-join.hpp>
 #include <immer/box.hpp>
 #include <immer/map.hpp>
 #include <immer/vector.hpp>
+#include <algorithm>
+#include <array>
+#include <optional>
+#include <utility>
+#include <vector>
 
 struct Collider
 {
@@ -21,6 +27,11 @@ struct Collider
     rectangle<meter_t> bounding_box;
   };
 
+  struct DetectOverlaps
+  {
+    CorrelationId correlation_id;
+  };
+
   //////////////////////////////////////////////////////////////////////////////
   // Events
   //////////////////////////////////////////////////////////////////////////////
@@ -32,6 +43,13 @@ struct Collider
     rectangle<meter_t> bounding_box;
   };
 
+  // All pairs of colliders whose bounding boxes overlap, the smaller entity id first, in ascending order
+  struct Overlaps
+  {
+    CorrelationId correlation_id;
+    std::vector<std::pair<EntityId, EntityId>> pairs;
+  };
+
   //////////////////////////////////////////////////////////////////////////////
   // State
   //////////////////////////////////////////////////////////////////////////////
@@ -43,7 +61,7 @@ struct Collider
     tensor<meter_t> position;
     radian_t rotation;
   };
-  using state_type = quad_tree<collider_t>;
+  using state_type = flat_quad_tree<collider_t, EntityId>;
 
   //////////////////////////////////////////////////////////////////////////////
   // Behaviour
@@ -56,25 +74,50 @@ struct Collider
     return { command.correlation_id, command.entity_id, command.bounding_box };
   }
 
+  //////////////////////////////////////////////////////////////////////////////
+  // Execute DetectOverlaps -> Overlaps
+  //
+  // Sort and sweep: the boxes are sorted by their left edge and every box is tested against the boxes that start
+  // before it ends. The sweep is split into four stripes of equally many boxes which run on the parallel executor.
+  template<typename Parallel>
+  static std::optional<Overlaps> execute(const state_type& state, const DetectOverlaps& command, Parallel&& parallel)
+  {
+    const auto boxes = sorted_boxes(state);
+    std::array<std::vector<std::pair<EntityId, EntityId>>, 4> stripes;
+    const auto stripe = [&](std::size_t s) {
+      return [&, s] { sweep(boxes, s * boxes.size() / 4, (s + 1) * boxes.size() / 4, stripes[s]); };
+    };
+    event_sauce::fork_join(parallel, stripe(0), stripe(1), stripe(2), stripe(3));
+
+    auto overlaps = Overlaps{ command.correlation_id, {} };
+    for (const auto& pairs : stripes) {
+      overlaps.pairs.insert(overlaps.pairs.end(), pairs.begin(), pairs.end());
+    }
+    if (overlaps.pairs.empty()) {
+      return std::nullopt;
+    }
+    std::sort(overlaps.pairs.begin(), overlaps.pairs.end());
+    return overlaps;
+  }
+
   //////////////////////////////////////////////////////////////////////////////
   // Apply Created
-  static state_type apply(const state_type& state, const Created& event)
+  static void apply(state_type& state, const Created& event)
   {
     auto collider = collider_t{ event.entity_id, event.bounding_box, { 0_m, 0_m }, 0_rad };
-    return insert(state, std::move(collider), { 0_m, 0_m });
+    state = insert(std::move(state), event.entity_id, std::move(collider), { 0_m, 0_m });
   }
 
   //////////////////////////////////////////////////////////////////////////////
   // Apply Entity::PositionChanged
-  static state_type apply(const state_type& state, const Entity::PositionChanged& evt)
+  static void apply(state_type& state, const Entity::PositionChanged& evt)
   {
-    return move(
-      state, evt.position, 10_m, [&evt](const auto& collider) { return evt.entity_id == collider.entity_id; });
+    state = move(std::move(state), evt.entity_id, evt.position);
   }
 
   //////////////////////////////////////////////////////////////////////////////
   // Apply Entity::RotationChanged
-  static state_type apply(const state_type& state, const Entity::RotationChanged& evt)
+  static void apply(state_type& state, const Entity::RotationChanged& evt)
   {
     /*
     if (const auto *c = state.find(evt.entity_id)) {
@@ -83,10 +126,63 @@ struct Collider
       return state.set(evt.entity_id, collider);
     }
     */
-    return state;
   }
 
   //////////////////////////////////////////////////////////////////////////////
   // Apply TimeAdvanced
-  static state_type apply(const state_type& state, const TimeAdvanced& event) { return state; }
+  static void apply(state_type& state, const TimeAdvanced& event) {}
+
+  //////////////////////////////////////////////////////////////////////////////
+  // Process TimeAdvanced -> DetectOverlaps
+  static DetectOverlaps process(const state_type& state, const TimeAdvanced& event)
+  {
+    return { event.correlation_id };
+  }
+
+  //////////////////////////////////////////////////////////////////////////////
+  // Broad phase
+  //////////////////////////////////////////////////////////////////////////////
+
+  struct world_box
+  {
+    double left, top, right, bottom;
+    EntityId entity_id;
+  };
+
+  // Bounding boxes in world coordinates, sorted by their left edge
+  static std::vector<world_box> sorted_boxes(const state_type& state)
+  {
+    auto boxes = std::vector<world_box>{};
+    boxes.reserve(state.size());
+    visit(state, [&boxes](const auto& entity) {
+      const auto& box = entity.payload.bounding_box;
+      const auto x = entity.position.x.template to<double>();
+      const auto y = entity.position.y.template to<double>();
+      const auto x0 = box.top_left.x.template to<double>();
+      const auto x1 = box.bottom_right.x.template to<double>();
+      const auto y0 = box.top_left.y.template to<double>();
+      const auto y1 = box.bottom_right.y.template to<double>();
+      boxes.push_back(
+        { x + std::min(x0, x1), y + std::min(y0, y1), x + std::max(x0, x1), y + std::max(y0, y1), entity.key });
+    });
+    std::sort(boxes.begin(), boxes.end(), [](const auto& a, const auto& b) { return a.left < b.left; });
+    return boxes;
+  }
+
+  // Pairs of a box in [begin, end) with a box after it
+  static void sweep(const std::vector<world_box>& boxes,
+                    std::size_t begin,
+                    std::size_t end,
+                    std::vector<std::pair<EntityId, EntityId>>& pairs)
+  {
+    for (auto i = begin; i < end; ++i) {
+      const auto& a = boxes[i];
+      for (auto j = i + 1; j < boxes.size() && boxes[j].left <= a.right; ++j) {
+        const auto& b = boxes[j];
+        if (b.top <= a.bottom && a.top <= b.bottom) {
+          pairs.emplace_back(std::min(a.entity_id, b.entity_id), std::max(a.entity_id, b.entity_id));
+        }
+      }
+    }
+  }
 };
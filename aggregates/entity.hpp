@@ -1,6 +1,7 @@
 #pragma once
 #include "../commands.hpp"
-#include <immer/map.hpp>
+#include "../common/memory.hpp"
+#include <immer/map_transient.hpp>
 
 using Active = bool;
 
@@ -74,8 +75,19 @@ public:
 
   struct state_type
   {
-    immer::map<EntityId, entity_t> entities;
+    state_map<EntityId, entity_t> entities;
     EntityId next_unused_entity_id = 0;
+
+    // Mutable copy used by batched dispatch, committed once per batch
+    struct transient_type
+    {
+      state_map<EntityId, entity_t>::transient_type entities;
+      EntityId next_unused_entity_id;
+
+      state_type persistent() { return { entities.persistent(), next_unused_entity_id }; }
+    };
+
+    transient_type transient() const { return { entities.transient(), next_unused_entity_id }; }
   };
 
   //////////////////////////////////////////////////////////////////////////////
@@ -142,4 +154,38 @@ public:
     next.entities = next.entities.set(event.entity_id, std::move(entity));
     return next;
   }
+
+  //////////////////////////////////////////////////////////////////////////////
+  // Apply EntityMoved (batched)
+  static void apply(state_type::transient_type& state, const PositionChanged& event)
+  {
+    const auto* found = state.entities.find(event.entity_id);
+    auto entity = found ? *found : entity_t{};
+    entity.position = event.position;
+    state.entities.set(event.entity_id, std::move(entity));
+  }
+
+  //////////////////////////////////////////////////////////////////////////////
+  // Apply EntityRotated (batched)
+  static void apply(state_type::transient_type& state, const RotationChanged& event)
+  {
+    const auto* found = state.entities.find(event.entity_id);
+    auto entity = found ? *found : entity_t{};
+    entity.rotation = event.rotation;
+    state.entities.set(event.entity_id, std::move(entity));
+  }
 };
+
+// Position and rotation are state updates, only the latest one per entity needs to go over the network, see the
+// coalescing in networking/common.hpp
+inline EntityId
+coalescing_key(const Entity::PositionChanged& evt)
+{
+  return evt.entity_id;
+}
+
+inline EntityId
+coalescing_key(const Entity::RotationChanged& evt)
+{
+  return evt.entity_id;
+}
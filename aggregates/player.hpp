@@ -1,10 +1,10 @@
 #pragma once
 #include "../commands.hpp"
+#include "../common/memory.hpp"
 #include "../common/units.hpp"
 #include "collider.hpp"
 #include "entity.hpp"
 #include "rigid_body.hpp"
-#include <immer/map.hpp>
 #include <tuple>
 #include <variant>
 
@@ -61,7 +61,7 @@ public:
 
   struct state_type
   {
-    immer::map<CorrelationId, player_t> players;
+    state_map<CorrelationId, player_t> players;
   };
 
   //////////////////////////////////////////////////////////////////////////////
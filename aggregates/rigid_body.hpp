@@ -1,9 +1,10 @@
 #pragma once
 #include "../commands.hpp"
+#include "../common/body_columns.hpp"
 #include "../common/units.hpp"
 #include "entity.hpp"
 #include "time.hpp"
-#include <immer/map.hpp>
+#include <event-sauce/misc/batch.hpp>
 
 struct RigidBody
 {
@@ -48,14 +49,8 @@ struct RigidBody
   // State
   //////////////////////////////////////////////////////////////////////////////
 
-  struct rigid_body_t
-  {
-    kilogram_t mass;
-    tensor<mps_t> velocity;
-    tensor<newton_t> force;
-  };
-
-  using state_type = immer::map<EntityId, rigid_body_t>;
+  // Bodies live in contiguous columns rather than in a persistent map, and every event is applied in place
+  using state_type = body_columns<EntityId>;
 
   //////////////////////////////////////////////////////////////////////////////
   // Behaviour
@@ -77,45 +72,32 @@ struct RigidBody
 
   //////////////////////////////////////////////////////////////////////////////
   // Apply ForceApplied
-  static state_type apply(const state_type& state, const ForceApplied& event)
-  {
-    rigid_body_t rb = state[event.entity_id];
-    rb.force += event.force;
-    return state.set(event.entity_id, std::move(rb));
-  }
+  static void apply(state_type& state, const ForceApplied& event) { add_force(state, event.entity_id, event.force); }
 
   //////////////////////////////////////////////////////////////////////////////
   // Apply Created
-  static state_type apply(const state_type& state, const Created& event)
+  static void apply(state_type& state, const Created& event)
   {
-    auto rb = rigid_body_t{ event.mass, event.velocity };
-    return state.set(event.entity_id, std::move(rb));
+    insert(state, event.entity_id, event.mass, event.velocity);
   }
 
   //////////////////////////////////////////////////////////////////////////////
   // Apply TimeAdvanced
-  static state_type apply(const state_type& state, const TimeAdvanced& event)
-  {
-    auto next = state;
-    for (auto [entity_id, rb] : state) {
-      rb.velocity += (rb.force / rb.mass) * event.dt;
-      rb.force = { 0_N, 0_N };
-      next = next.set(entity_id, std::move(rb));
-    }
-    return next;
-  }
+  static void apply(state_type& state, const TimeAdvanced& event) { integrate(state, event.dt); }
 
   //////////////////////////////////////////////////////////////////////////////
   // Process TimeAdvanced -> [Entity::Move]
-  static std::vector<Entity::Move> process(const state_type& state, const TimeAdvanced& event)
+  //
+  // The moves are returned as one batch, which event-sauce executes against one snapshot and commits at once.
+  static event_sauce::batch<Entity::Move> process(const state_type& state, const TimeAdvanced& event)
   {
-    std::vector<Entity::Move> commands;
-    for (auto [entity_id, rb] : state) {
-      if (rb.velocity.x != 0_mps && rb.velocity.y != 0_mps) {
-        auto position = rb.velocity * event.dt;
-        commands.push_back({ event.correlation_id, entity_id, position });
+    event_sauce::batch<Entity::Move> moves;
+    for (auto row = std::size_t{ 0 }; row < state.size(); ++row) {
+      if (state.vx[row] != 0.0 && state.vy[row] != 0.0) {
+        auto position = state.velocity(row) * event.dt;
+        moves.commands.push_back({ event.correlation_id, state.ids[row], position });
       }
     }
-    return commands;
+    return moves;
   }
 };
@@ -1,5 +1,6 @@
 #pragma once
 #include "../commands.hpp"
+#include "../common/memory.hpp"
 #include "entity.hpp"
 #include <memory>
 
@@ -39,7 +40,7 @@ struct Sprite
     tensor<meter_t> rotation;
   };
 
-  using state_type = immer::map<EntityId, sprite_t>;
+  using state_type = state_map<EntityId, sprite_t>;
 
   //////////////////////////////////////////////////////////////////////////////
   // Behaviour
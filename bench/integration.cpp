@@ -0,0 +1,129 @@
+// Measures the physics integration step, RigidBody::apply(TimeAdvanced), for growing numbers of bodies.
+//
+// The map variants are the previous implementations, which kept every body in an immer::map: 'per-body' set each
+// body on the persistent map and rebuilt one path per body, 'transient' wrote all of them into one transient. The
+// column variants run over RigidBody's structure-of-arrays state, with the scalar loop only and with the widest
+// kernel this build enables. Every tick starts from a state where every body has a pending force.
+//
+// Allocations are those that reach the system heap through the state memory policy, i.e. that the free lists could
+// not serve.
+#include "../aggregates/rigid_body.hpp"
+#include "../common/memory.hpp"
+#include <immer/map_transient.hpp>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+namespace {
+
+struct rigid_body_t
+{
+  kilogram_t mass;
+  tensor<mps_t> velocity;
+  tensor<newton_t> force;
+};
+
+using body_map = state_map<EntityId, rigid_body_t>;
+
+body_map
+apply_per_body(const body_map& state, second_t dt)
+{
+  auto next = state;
+  for (auto [entity_id, rb] : state) {
+    rb.velocity += (rb.force / rb.mass) * dt;
+    rb.force = { 0_N, 0_N };
+    next = next.set(entity_id, std::move(rb));
+  }
+  return next;
+}
+
+body_map
+apply_transient(const body_map& state, second_t dt)
+{
+  auto next = state.transient();
+  for (const auto& [entity_id, rb] : state) {
+    auto integrated = rb;
+    integrated.velocity += (rb.force / rb.mass) * dt;
+    integrated.force = { 0_N, 0_N };
+    next.set(entity_id, std::move(integrated));
+  }
+  return next.persistent();
+}
+
+body_map
+make_map(int count)
+{
+  auto state = body_map{}.transient();
+  for (auto id = 0; id < count; ++id) {
+    state.set(id, rigid_body_t{ 1_kg, { 0_mps, 0_mps }, { 1_N, 1_N } });
+  }
+  return state.persistent();
+}
+
+RigidBody::state_type
+make_columns(int count)
+{
+  auto state = RigidBody::state_type{};
+  for (auto id = 0; id < count; ++id) {
+    insert(state, id, 1_kg, { 0_mps, 0_mps });
+    add_force(state, id, { 1_N, 1_N });
+  }
+  return state;
+}
+
+template<typename Initial, typename Tick>
+void
+benchmark(const char* name, int count, Initial&& initial, Tick&& tick)
+{
+  const auto dt = 0.016_s;
+  const auto ticks = std::max(1, 1000000 / count);
+
+  auto checksum = 0.0;
+  auto elapsed = std::chrono::steady_clock::duration{};
+  auto allocations = allocation_counters{};
+  for (auto i = 0; i < ticks; ++i) {
+    auto state = initial;
+    const auto before = allocation_snapshot();
+    const auto begin = std::chrono::steady_clock::now();
+    checksum += tick(state, dt);
+    elapsed += std::chrono::steady_clock::now() - begin;
+    const auto tick_allocations = allocation_snapshot() - before;
+    allocations.allocations += tick_allocations.allocations;
+    allocations.bytes += tick_allocations.bytes;
+  }
+
+  const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+  const auto per_tick = static_cast<double>(ns) / ticks;
+  std::cout << "  " << name << ": " << per_tick / 1000.0 << " us/tick, " << count / per_tick * 1000.0
+            << " Mbodies/s, " << allocations.allocations / ticks << " allocations/tick, " << allocations.bytes / ticks
+            << " bytes/tick (checksum " << checksum << ")" << std::endl;
+}
+
+} // namespace
+
+int
+main()
+{
+  for (const auto count : { 1000, 10000, 100000 }) {
+    std::cout << count << " bodies" << std::endl;
+    const auto map = make_map(count);
+    const auto columns = make_columns(count);
+    benchmark("map per-body  ", count, map, [count](body_map& state, second_t dt) {
+      return apply_per_body(state, dt)[count / 2].velocity.x.to<double>();
+    });
+    benchmark("map transient ", count, map, [count](body_map& state, second_t dt) {
+      return apply_transient(state, dt)[count / 2].velocity.x.to<double>();
+    });
+    benchmark("columns scalar", count, columns, [](RigidBody::state_type& state, second_t dt) {
+      body_columns_detail::integrate_scalar(
+        state.vx.data(), state.vy.data(), state.fx.data(), state.fy.data(), state.inv_mass.data(), 0, state.size(),
+        dt.to<double>());
+      return state.vx[state.size() / 2];
+    });
+    benchmark("columns wide  ", count, columns, [](RigidBody::state_type& state, second_t dt) {
+      RigidBody::apply(state, TimeAdvanced{ 0, dt });
+      return state.vx[state.size() / 2];
+    });
+  }
+  return 0;
+}
@@ -0,0 +1,78 @@
+// Measures loopback round trips through a Router: the pinging client broadcasts a message, the router forwards it to
+// the echoing client, which broadcasts it back. Only one message is in flight at a time, so every round trip is four
+// hops through the client I/O loops and the router.
+#include "../networking/client.hpp"
+#include "../networking/router.hpp"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Ping
+{
+  int sequence;
+};
+
+template<class Archive>
+void
+serialize(Archive& ar, Ping& evt, const unsigned int version)
+{
+  ar& evt.sequence;
+}
+
+} // namespace
+
+int
+main()
+{
+  static constexpr auto endpoint = "tcp://127.0.0.1:5556";
+  static constexpr auto round_trips = 10000;
+
+  std::thread{ [] { Router<Ping>::event_loop(endpoint); } }.detach();
+
+  auto echo = Client<Ping>{ endpoint };
+  echo.start([&echo](std::string, Ping ping) { echo.publish(ping); });
+
+  std::mutex mutex;
+  std::condition_variable returned;
+  auto last = -1;
+  auto ping = Client<Ping>{ endpoint };
+  ping.start([&](std::string, Ping pong) {
+    {
+      const auto lock = std::lock_guard{ mutex };
+      last = pong.sequence;
+    }
+    returned.notify_one();
+  });
+
+  // Both clients must have been seen by the router before a broadcast reaches the other one
+  std::this_thread::sleep_for(std::chrono::milliseconds{ 200 });
+
+  auto latencies = std::vector<double>{};
+  latencies.reserve(round_trips);
+  for (auto sequence = 0; sequence < round_trips; ++sequence) {
+    const auto begin = std::chrono::steady_clock::now();
+    ping.publish(Ping{ sequence });
+    auto lock = std::unique_lock{ mutex };
+    returned.wait(lock, [&] { return last == sequence; });
+    const auto elapsed = std::chrono::steady_clock::now() - begin;
+    latencies.push_back(std::chrono::duration<double, std::micro>(elapsed).count());
+  }
+
+  std::sort(latencies.begin(), latencies.end());
+  const auto percentile = [&latencies](double p) {
+    return latencies[static_cast<std::size_t>(p * (latencies.size() - 1))];
+  };
+  std::cout << round_trips << " round trips: p50 " << percentile(0.5) << " us, p99 " << percentile(0.99)
+            << " us, max " << latencies.back() << " us" << std::endl;
+
+  // The router never returns, so leave without unwinding the clients
+  std::quick_exit(0);
+}
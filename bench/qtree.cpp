@@ -0,0 +1,110 @@
+// Measures broad-phase queries on the pointer-based quad_tree and on the flat_quad_tree that Collider uses, for growing
+// numbers of colliders spread uniformly over the tree.
+//
+// 'query' collects the hits in an immer::vector, 'visit' only counts them and 'query out' copies them into a reused
+// std::vector. 'nearest' finds the 8 colliders closest to a point. Every variant runs the same queries.
+//
+// Allocations are those that reach the system heap through the state memory policy, i.e. that the free lists could
+// not serve.
+#include "../aggregates/collider.hpp"
+#include "../common/flat_qtree.hpp"
+#include "../common/memory.hpp"
+#include "../common/qtree.hpp"
+#include <chrono>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <vector>
+
+namespace {
+
+using box_type = quad_tree<Collider::collider_t, EntityId>::BoundingBox;
+
+template<typename Tree>
+Tree
+make_tree(int count, std::mt19937& rng)
+{
+  auto coordinate = std::uniform_real_distribution<double>{ -1000.0, 1000.0 };
+  auto tree = Tree{};
+  for (auto id = 0; id < count; ++id) {
+    const auto position = tensor<meter_t>{ meter_t{ coordinate(rng) }, meter_t{ coordinate(rng) } };
+    tree = insert(std::move(tree), id, Collider::collider_t{ id, {}, position, 0_rad }, position);
+  }
+  return tree;
+}
+
+std::vector<box_type>
+make_ranges(int count, meter_t half_dimension, std::mt19937& rng)
+{
+  auto coordinate = std::uniform_real_distribution<double>{ -1000.0, 1000.0 };
+  auto ranges = std::vector<box_type>{};
+  for (auto i = 0; i < count; ++i) {
+    ranges.push_back({ { meter_t{ coordinate(rng) }, meter_t{ coordinate(rng) } }, half_dimension });
+  }
+  return ranges;
+}
+
+template<typename Query>
+void
+benchmark(const char* name, const std::vector<box_type>& ranges, Query&& query)
+{
+  auto hits = std::size_t{ 0 };
+  const auto before = allocation_snapshot();
+  const auto begin = std::chrono::steady_clock::now();
+  for (const auto& range : ranges) {
+    hits += query(range);
+  }
+  const auto elapsed = std::chrono::steady_clock::now() - begin;
+  const auto allocations = allocation_snapshot() - before;
+
+  const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+  const auto per_query = static_cast<double>(ns) / ranges.size();
+  std::cout << "  " << name << ": " << per_query / 1000.0 << " us/query, " << static_cast<double>(hits) / ranges.size()
+            << " hits/query, " << static_cast<double>(allocations.allocations) / ranges.size() << " allocations/query"
+            << std::endl;
+}
+
+template<typename Tree>
+void
+benchmark_tree(const Tree& tree, const std::vector<box_type>& ranges)
+{
+  benchmark("query    ", ranges, [&tree](const box_type& range) { return query(tree, range).size(); });
+  benchmark("visit    ", ranges, [&tree](const box_type& range) {
+    auto hits = std::size_t{ 0 };
+    visit(tree, range, [&hits](const auto&) { ++hits; });
+    return hits;
+  });
+  auto found = std::vector<typename Tree::Entity>{};
+  benchmark("query out", ranges, [&tree, &found](const box_type& range) {
+    found.clear();
+    query(tree, range, std::back_inserter(found));
+    return found.size();
+  });
+  benchmark("nearest 8", ranges, [&tree, &found](const box_type& range) {
+    found.clear();
+    nearest(tree, range.center, 8, std::back_inserter(found));
+    return found.size();
+  });
+}
+
+} // namespace
+
+int
+main()
+{
+  auto rng = std::mt19937{ 42 };
+  for (const auto count : { 10000, 100000, 1000000 }) {
+    // Both trees hold the same colliders
+    auto same_rng = rng;
+    const auto pointers = make_tree<quad_tree<Collider::collider_t, EntityId>>(count, same_rng);
+    const auto flat = make_tree<flat_quad_tree<Collider::collider_t, EntityId>>(count, rng);
+    for (const auto half_dimension : { 10_m, 50_m }) {
+      const auto ranges = make_ranges(1000, half_dimension, rng);
+      std::cout << count << " colliders, " << half_dimension << " ranges, quad_tree" << std::endl;
+      benchmark_tree(pointers, ranges);
+      std::cout << count << " colliders, " << half_dimension << " ranges, flat_quad_tree" << std::endl;
+      benchmark_tree(flat, ranges);
+    }
+  }
+  return 0;
+}
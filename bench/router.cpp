@@ -0,0 +1,144 @@
+// Loopback load generator for the router: publishing clients broadcast messages of eight event types as fast as the
+// router delivers them to the subscribing clients. Each run is a different router configuration: the single-threaded
+// event loop, and the sharded event loop with growing numbers of shards. The subscribers are subscribed either to
+// every event type or to one of them, to show how the delivered load follows the selectivity of the subscriptions.
+//
+// Messages are published in windows, and the next window is only published once the previous one has been delivered
+// completely, so no subscriber falls so far behind that the ROUTER socket drops what it sends it at the high-water
+// mark. The pipes between the frontend and the shards of the sharded router are unbounded and need no such limit.
+#include "../networking/client.hpp"
+#include "../networking/router.hpp"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+template<std::size_t Type>
+struct Topic
+{
+  int sequence;
+};
+
+template<class Archive, std::size_t Type>
+void
+serialize(Archive& ar, Topic<Type>& evt, const unsigned int version)
+{
+  ar& evt.sequence;
+}
+
+template<std::size_t... Types>
+auto make_message_type(std::index_sequence<Types...>) -> std::variant<Topic<Types>...>;
+
+using message_type = decltype(make_message_type(std::make_index_sequence<8>{}));
+using client_type = Client<message_type>;
+
+constexpr auto types = std::variant_size_v<message_type>;
+constexpr auto publishers = 4;
+constexpr auto subscribers = 16;
+constexpr auto windows = 50;
+constexpr auto window = 1000;
+
+template<std::size_t... Types>
+message_type
+make_message(std::size_t type, int sequence, std::index_sequence<Types...>)
+{
+  using maker = message_type (*)(int);
+  static const auto makers =
+    std::array<maker, sizeof...(Types)>{ [](int s) { return message_type{ Topic<Types>{ s } }; }... };
+  return makers[type](sequence);
+}
+
+// Shards of 0 run the single-threaded event loop
+void
+run(int port, std::size_t shards, std::size_t subscribed_types)
+{
+  const auto endpoint = "tcp://127.0.0.1:" + std::to_string(port);
+  std::thread{ [endpoint, shards] {
+    if (shards == 0) {
+      Router<message_type>::event_loop(endpoint);
+    } else {
+      Router<message_type>::sharded_event_loop(endpoint, shards);
+    }
+  } }.detach();
+
+  std::atomic<std::size_t> delivered{ 0 };
+  auto subscribed = std::array<std::size_t, types>{};
+  auto clients = std::vector<std::unique_ptr<client_type>>{};
+  for (auto i = 0; i < subscribers; ++i) {
+    auto subscription = subscription_type{ 0 };
+    for (auto j = std::size_t{ 0 }; j < subscribed_types; ++j) {
+      const auto type = (i + j) % types;
+      subscription |= subscription_type{ 1 } << type;
+      ++subscribed[type];
+    }
+    auto& client = clients.emplace_back(std::make_unique<client_type>(endpoint));
+    client->start([&delivered](std::string, message_type) { delivered.fetch_add(1, std::memory_order_relaxed); });
+    client->subscribe(subscription);
+  }
+  for (auto i = 0; i < publishers; ++i) {
+    auto& client = clients.emplace_back(std::make_unique<client_type>(endpoint));
+    client->start([](std::string, message_type) {});
+    client->subscribe(0);
+  }
+
+  // Every client must have been seen by the router before the first broadcast
+  std::this_thread::sleep_for(std::chrono::milliseconds{ 200 });
+
+  auto expected = std::size_t{ 0 };
+  const auto begin = std::chrono::steady_clock::now();
+  for (auto w = 0; w < windows; ++w) {
+    auto threads = std::vector<std::thread>{};
+    for (auto p = 0; p < publishers; ++p) {
+      threads.emplace_back([&client = *clients[subscribers + p], w] {
+        for (auto i = 0; i < window; ++i) {
+          client.publish(make_message(i % types, w * window + i, std::make_index_sequence<types>{}));
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    for (auto i = 0; i < window; ++i) {
+      expected += publishers * subscribed[i % types];
+    }
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds{ 10 };
+    while (delivered.load(std::memory_order_relaxed) < expected && std::chrono::steady_clock::now() < deadline) {
+      std::this_thread::yield();
+    }
+  }
+  const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+  const auto published = publishers * windows * window;
+  std::cout << (shards == 0 ? std::string{ "single" } : std::to_string(shards) + " shards") << ", "
+            << subscribed_types << "/" << types << " types subscribed: " << published / elapsed << " published/s, "
+            << delivered.load() / elapsed << " delivered/s";
+  if (delivered.load() < expected) {
+    std::cout << " (" << expected - delivered.load() << " lost)";
+  }
+  std::cout << std::endl;
+}
+
+} // namespace
+
+int
+main()
+{
+  auto port = 5600;
+  for (const auto subscribed_types : { types, std::size_t{ 1 } }) {
+    for (const auto shards : { 0, 1, 2, 4, 8 }) {
+      run(port++, shards, subscribed_types);
+    }
+  }
+
+  // The routers never return, so leave without unwinding them
+  std::quick_exit(0);
+}
@@ -0,0 +1,107 @@
+// Runs the same event-sauce workload on every scheduler, so that execution strategies can be compared per deployment.
+//
+// Every Step is handled by a number of aggregates whose apply() does a fixed amount of arithmetic, which is the
+// shape of RigidBody and Collider on TimeAdvanced.
+#include "../pool_dispatcher.hpp"
+#include "../scheduler/fiber.hpp"
+#include <event-sauce/event-sauce.hpp>
+#include <chrono>
+#include <cmath>
+#include <future>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+struct Step
+{};
+
+struct Stepped
+{};
+
+struct Clock
+{
+  struct state_type
+  {};
+
+  static Stepped execute(const state_type&, const Step&) { return {}; }
+};
+
+template<int Id>
+struct Heavy
+{
+  struct state_type
+  {
+    std::vector<float> values = std::vector<float>(4096, 1.0f);
+  };
+
+  static void apply(state_type& state, const Stepped&)
+  {
+    for (auto& value : state.values) {
+      value = std::sqrt(value * value + 1.0f);
+    }
+  }
+};
+
+template<typename Scheduler, typename Start, typename Stop>
+void
+benchmark(const char* name, Scheduler& scheduler, std::size_t steps, Start&& start, Stop&& stop)
+{
+  auto ctx = event_sauce::make_context<Clock, Heavy<0>, Heavy<1>, Heavy<2>, Heavy<3>, Heavy<4>, Heavy<5>>();
+  auto done = std::promise<void>{};
+  auto count = std::size_t{ 0 };
+  auto projector = [&](const auto& evt) {
+    if constexpr (std::is_same_v<std::decay_t<decltype(evt)>, Stepped>) {
+      if (++count == steps) {
+        done.set_value();
+      }
+    }
+  };
+  auto engine = event_sauce::make_engine(ctx, projector, scheduler);
+  start();
+
+  const auto begin = std::chrono::steady_clock::now();
+  for (auto i = std::size_t{ 0 }; i < steps; ++i) {
+    engine.dispatch()(Step{});
+  }
+  done.get_future().wait();
+  const auto elapsed = std::chrono::steady_clock::now() - begin;
+
+  // The task that set done is still running, wait for it before the engine, the context and done go away
+  engine.stop();
+  engine.run();
+  stop();
+  const auto us = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+  std::cout << name << ": " << static_cast<double>(us) / steps << " us/step" << std::endl;
+}
+
+int
+main()
+{
+  static constexpr auto steps = std::size_t{ 2000 };
+  const auto threads = static_cast<int>(std::max(2u, std::thread::hardware_concurrency()));
+
+  {
+    auto scheduler = event_sauce::inline_scheduler{};
+    benchmark("inline", scheduler, steps, [] {}, [] {});
+  }
+
+  {
+    auto scheduler = pool_dispatcher{ threads };
+    benchmark("pool  ", scheduler, steps, [] {}, [] {});
+  }
+
+  {
+    auto scheduler = fiber_scheduler{ 64, 64 };
+    auto worker = std::thread{};
+    benchmark(
+      "fiber ",
+      scheduler,
+      steps,
+      [&] { worker = std::thread{ [&] { fiber_worker(scheduler, threads).run(); } }; },
+      [&] {
+        scheduler.close();
+        worker.join();
+      });
+  }
+  return 0;
+}
@@ -0,0 +1,126 @@
+// Measures the encode/decode round trip of a networking message, with the boost::archive codec the networking code
+// used before and with the wire codec it uses now.
+//
+// 'archive' writes a binary_oarchive into a std::ostringstream, copies the result into a std::string and reads it
+// back through a binary_iarchive, the way Client and Router did. 'wire' measures the message, encodes it into a fresh
+// buffer of that size, like a zmq::message_t, and decodes straight out of that buffer.
+#include "../networking/wire.hpp"
+#include "../vendor/serialize_std_variant.hpp"
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/serialization/string.hpp>
+#include <boost/serialization/utility.hpp>
+#include <boost/serialization/vector.hpp>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <variant>
+#include <vector>
+
+namespace {
+
+struct Spoke
+{
+  std::string sentence;
+};
+
+struct Moved
+{
+  int entity_id;
+  double x, y;
+  std::vector<std::pair<int, int>> contacts;
+};
+
+template<class Archive>
+void
+serialize(Archive& ar, Spoke& evt, const unsigned int version)
+{
+  ar& evt.sentence;
+}
+
+template<class Archive>
+void
+serialize(Archive& ar, Moved& evt, const unsigned int version)
+{
+  ar& evt.entity_id& evt.x& evt.y& evt.contacts;
+}
+
+using message_type = std::variant<Spoke, Moved>;
+
+// The shape of event<message_type>::recv_type
+struct recv_type
+{
+  std::string from;
+  message_type message;
+
+  template<typename Archive>
+  void serialize(Archive& ar, const unsigned int version)
+  {
+    ar & this->from;
+    ar & this->message;
+  }
+};
+
+template<typename RoundTrip>
+void
+benchmark(const char* name, const recv_type& message, int count, RoundTrip&& round_trip)
+{
+  auto bytes = std::size_t{ 0 };
+  const auto begin = std::chrono::steady_clock::now();
+  for (auto i = 0; i < count; ++i) {
+    bytes += round_trip(message);
+  }
+  const auto elapsed = std::chrono::steady_clock::now() - begin;
+
+  const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+  std::cout << "  " << name << ": " << static_cast<double>(ns) / count << " ns/message, "
+            << static_cast<double>(bytes) / count << " bytes/message" << std::endl;
+}
+
+std::size_t
+archive_round_trip(const recv_type& message)
+{
+  std::ostringstream out;
+  {
+    boost::archive::binary_oarchive oa{ out };
+    oa << message;
+  }
+  const auto str = out.str();
+
+  auto decoded = recv_type{};
+  std::istringstream in{ str };
+  boost::archive::binary_iarchive ia{ in };
+  ia >> decoded;
+  return str.size();
+}
+
+std::size_t
+wire_round_trip(const recv_type& message)
+{
+  const auto size = wire::encoded_size(message);
+  const auto buffer = std::make_unique<char[]>(size);
+  wire::encode(message, buffer.get());
+
+  const auto decoded = wire::decode<recv_type>(buffer.get(), size);
+  return decoded ? size : 0;
+}
+
+} // namespace
+
+int
+main()
+{
+  constexpr auto count = 100000;
+  const auto messages = {
+    std::make_pair("chat", recv_type{ "client-1", Spoke{ "Hello 42" } }),
+    std::make_pair("movement", recv_type{ "client-1", Moved{ 7, 1.5, -2.5, { { 7, 8 }, { 7, 12 }, { 7, 31 } } } }),
+  };
+  for (const auto& [name, message] : messages) {
+    std::cout << name << " message" << std::endl;
+    benchmark("archive", message, count, archive_round_trip);
+    benchmark("wire   ", message, count, wire_round_trip);
+  }
+  return 0;
+}
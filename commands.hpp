@@ -1,5 +1,6 @@
 #pragma once
 #include "common/units.hpp"
+#include <array>
 #include <vector>
 
 using EntityId = int;
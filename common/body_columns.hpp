@@ -0,0 +1,160 @@
+#pragma once
+#include "units.hpp"
+#include <cstddef>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__AVX__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+// Rigid bodies stored as a structure of arrays, one contiguous column per component in SI units, so the integration
+// step streams through memory and can process several bodies per instruction.
+//
+// Rows are never removed; 'index' maps an entity id to its row and 'ids' maps back.
+template<typename Id>
+struct body_columns
+{
+  std::vector<Id> ids;
+  std::vector<double> vx, vy;
+  std::vector<double> fx, fy;
+  std::vector<double> inv_mass;
+  std::unordered_map<Id, std::size_t> index;
+
+  std::size_t size() const { return ids.size(); }
+
+  std::optional<std::size_t> find(const Id& id) const
+  {
+    const auto it = index.find(id);
+    if (it == index.end()) {
+      return std::nullopt;
+    }
+    return it->second;
+  }
+
+  tensor<mps_t> velocity(std::size_t row) const { return { mps_t{ vx[row] }, mps_t{ vy[row] } }; }
+};
+
+// Adds a body, or resets it if the id is already present. A zero mass makes the body immovable.
+template<typename Id>
+void
+insert(body_columns<Id>& bodies, const Id& id, kilogram_t mass, tensor<mps_t> velocity)
+{
+  const auto kg = mass.template to<double>();
+  const auto inv_mass = kg != 0.0 ? 1.0 / kg : 0.0;
+  if (const auto row = bodies.find(id)) {
+    bodies.vx[*row] = velocity.x.template to<double>();
+    bodies.vy[*row] = velocity.y.template to<double>();
+    bodies.fx[*row] = bodies.fy[*row] = 0.0;
+    bodies.inv_mass[*row] = inv_mass;
+    return;
+  }
+  bodies.index.emplace(id, bodies.size());
+  bodies.ids.push_back(id);
+  bodies.vx.push_back(velocity.x.template to<double>());
+  bodies.vy.push_back(velocity.y.template to<double>());
+  bodies.fx.push_back(0.0);
+  bodies.fy.push_back(0.0);
+  bodies.inv_mass.push_back(inv_mass);
+}
+
+// Accumulates a force on the body until the next integration step. Unknown ids are ignored.
+template<typename Id>
+void
+add_force(body_columns<Id>& bodies, const Id& id, tensor<newton_t> force)
+{
+  if (const auto row = bodies.find(id)) {
+    bodies.fx[*row] += force.x.template to<double>();
+    bodies.fy[*row] += force.y.template to<double>();
+  }
+}
+
+namespace body_columns_detail {
+
+inline void
+integrate_scalar(double* vx,
+                 double* vy,
+                 double* fx,
+                 double* fy,
+                 const double* inv_mass,
+                 std::size_t begin,
+                 std::size_t end,
+                 double dt)
+{
+  for (auto i = begin; i < end; ++i) {
+    const auto scale = inv_mass[i] * dt;
+    vx[i] += fx[i] * scale;
+    vy[i] += fy[i] * scale;
+    fx[i] = 0.0;
+    fy[i] = 0.0;
+  }
+}
+
+#if defined(__AVX__)
+
+inline std::size_t
+integrate_wide(double* vx, double* vy, double* fx, double* fy, const double* inv_mass, std::size_t n, double dt)
+{
+  const auto step = _mm256_set1_pd(dt);
+  const auto zero = _mm256_setzero_pd();
+  auto i = std::size_t{ 0 };
+  for (; i + 4 <= n; i += 4) {
+    const auto scale = _mm256_mul_pd(_mm256_loadu_pd(inv_mass + i), step);
+    _mm256_storeu_pd(vx + i, _mm256_add_pd(_mm256_loadu_pd(vx + i), _mm256_mul_pd(_mm256_loadu_pd(fx + i), scale)));
+    _mm256_storeu_pd(vy + i, _mm256_add_pd(_mm256_loadu_pd(vy + i), _mm256_mul_pd(_mm256_loadu_pd(fy + i), scale)));
+    _mm256_storeu_pd(fx + i, zero);
+    _mm256_storeu_pd(fy + i, zero);
+  }
+  return i;
+}
+
+#elif defined(__SSE2__) || defined(_M_X64)
+
+inline std::size_t
+integrate_wide(double* vx, double* vy, double* fx, double* fy, const double* inv_mass, std::size_t n, double dt)
+{
+  const auto step = _mm_set1_pd(dt);
+  const auto zero = _mm_setzero_pd();
+  auto i = std::size_t{ 0 };
+  for (; i + 2 <= n; i += 2) {
+    const auto scale = _mm_mul_pd(_mm_loadu_pd(inv_mass + i), step);
+    _mm_storeu_pd(vx + i, _mm_add_pd(_mm_loadu_pd(vx + i), _mm_mul_pd(_mm_loadu_pd(fx + i), scale)));
+    _mm_storeu_pd(vy + i, _mm_add_pd(_mm_loadu_pd(vy + i), _mm_mul_pd(_mm_loadu_pd(fy + i), scale)));
+    _mm_storeu_pd(fx + i, zero);
+    _mm_storeu_pd(fy + i, zero);
+  }
+  return i;
+}
+
+#else
+
+inline std::size_t
+integrate_wide(double*, double*, double*, double*, const double*, std::size_t, double)
+{
+  return 0;
+}
+
+#endif
+
+} // namespace body_columns_detail
+
+// integrate :: bodies -> dt -> ()
+//
+// v += f / m * dt for every body, then clears the accumulated forces. Uses AVX when the translation unit is built with
+// it enabled (e.g. -mavx or -march=native), SSE2 on other x86-64 builds, and plain loops elsewhere; the tail that does
+// not fill a register is always handled by the scalar loop.
+template<typename Id>
+void
+integrate(body_columns<Id>& bodies, second_t dt)
+{
+  const auto n = bodies.size();
+  const auto seconds = dt.template to<double>();
+  auto* vx = bodies.vx.data();
+  auto* vy = bodies.vy.data();
+  auto* fx = bodies.fx.data();
+  auto* fy = bodies.fy.data();
+  const auto* inv_mass = bodies.inv_mass.data();
+  const auto done = body_columns_detail::integrate_wide(vx, vy, fx, fy, inv_mass, n, seconds);
+  body_columns_detail::integrate_scalar(vx, vy, fx, fy, inv_mass, done, n, seconds);
+}
@@ -0,0 +1,453 @@
+#pragma once
+#include "memory.hpp"
+#include "qtree.hpp"
+#include "units.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+// Flat quad tree
+//
+// A drop-in alternative to quad_tree with the same free functions. Nodes live in fixed-size pages of a flat array and
+// refer to their children by index; the four children of a node are allocated together, in Z order, and compact()
+// lays the whole tree out in depth-first Z order, i.e. Morton order, so that a subtree occupies a contiguous range of
+// pages. Entities are kept in a bucket of up to bucket_size entries next to their leaf.
+//
+// Copies share their pages. A page is copied the first time a tree that shares it is changed, so a tree that is moved
+// into every update is changed in place, while a tree that has been copied (e.g. by a snapshot) costs one page copy
+// per page that is touched afterwards.
+//
+// T and Key must be default constructible.
+template<typename T, typename Key = int>
+class flat_quad_tree
+{
+public:
+  using BoundingBox = typename QuadTreeImpl<T, Key>::BoundingBox;
+  using Entity = typename QuadTreeImpl<T, Key>::Entity;
+
+  static constexpr std::size_t bucket_size = 16;
+  static constexpr std::size_t page_size = 8;
+  static constexpr std::uint32_t max_depth = 24;
+
+  // Index of the node of entities outside of the root, or in a full leaf at max_depth
+  static constexpr std::uint32_t outside = std::numeric_limits<std::uint32_t>::max();
+  static constexpr std::uint32_t no_children = 0;
+
+  struct node_type
+  {
+    BoundingBox boundary;
+    std::uint32_t parent = 0;
+    std::uint32_t first_child = no_children;
+    std::uint32_t depth = 0;
+    std::uint32_t count = 0;
+
+    bool leaf() const { return first_child == no_children; }
+  };
+
+  struct page_type
+  {
+    std::array<node_type, page_size> nodes;
+    std::array<std::array<Entity, bucket_size>, page_size> buckets;
+  };
+
+  flat_quad_tree(meter_t x = 0_m, meter_t y = 0_m, meter_t half_dimension = 1000_m)
+      : pages{ std::make_shared<page_type>() }
+  {
+    pages.front()->nodes[0].boundary = { { x, y }, half_dimension };
+  }
+
+  std::size_t size() const { return index.size(); }
+
+  std::uint32_t node_count() const { return allocated; }
+
+  const node_type& node(std::uint32_t n) const { return pages[n / page_size]->nodes[n % page_size]; }
+
+  const Entity* bucket(std::uint32_t n) const { return pages[n / page_size]->buckets[n % page_size].data(); }
+
+  ////////////////////////////////////////////////////////////////////////////////
+  // Mutation, used by the free functions below
+  ////////////////////////////////////////////////////////////////////////////////
+
+  node_type& writable_node(std::uint32_t n) { return writable_page(n / page_size).nodes[n % page_size]; }
+
+  Entity* writable_bucket(std::uint32_t n) { return writable_page(n / page_size).buckets[n % page_size].data(); }
+
+  // Leaf below n whose boundary contains position
+  std::uint32_t leaf_of(std::uint32_t n, tensor<meter_t> position) const
+  {
+    while (!node(n).leaf()) {
+      n = node(n).first_child + node(n).boundary.quadrant_of(position);
+    }
+    return n;
+  }
+
+  // Puts the entity in the leaf below n that contains it, splitting full leaves on the way
+  void place(std::uint32_t n, Entity entity)
+  {
+    if (!node(0).boundary.contains(entity.position)) {
+      index = index.set(entity.key, outside);
+      outsiders = outsiders.push_back(std::move(entity));
+      return;
+    }
+    n = leaf_of(n, entity.position);
+    while (node(n).count == bucket_size && node(n).depth < max_depth) {
+      split(n);
+      n = leaf_of(n, entity.position);
+    }
+    if (node(n).count == bucket_size) {
+      // Only entities piled up at one point get here, they are looked at by every query like those outside of the root
+      index = index.set(entity.key, outside);
+      outsiders = outsiders.push_back(std::move(entity));
+      return;
+    }
+    auto& leaf = writable_node(n);
+    writable_bucket(n)[leaf.count++] = entity;
+    index = index.set(entity.key, n);
+  }
+
+  // Takes the entity out of its node and returns it
+  std::optional<Entity> take(const Key& key)
+  {
+    const auto* found = index.find(key);
+    if (!found) {
+      return std::nullopt;
+    }
+    const auto n = *found;
+    index = index.erase(key);
+    if (n == outside) {
+      for (auto i = std::size_t{ 0 }; i < outsiders.size(); ++i) {
+        if (outsiders[i].key == key) {
+          auto entity = outsiders[i];
+          outsiders = outsiders.erase(i);
+          return entity;
+        }
+      }
+      return std::nullopt;
+    }
+    auto& leaf = writable_node(n);
+    auto* entities = writable_bucket(n);
+    for (auto i = std::uint32_t{ 0 }; i < leaf.count; ++i) {
+      if (entities[i].key == key) {
+        auto entity = std::move(entities[i]);
+        entities[i] = std::move(entities[leaf.count - 1]);
+        --leaf.count;
+        return entity;
+      }
+    }
+    return std::nullopt;
+  }
+
+  // Copy with the nodes laid out in depth-first Z order
+  flat_quad_tree compacted() const
+  {
+    const auto& root = node(0).boundary;
+    auto result = flat_quad_tree{ root.center.x, root.center.y, root.half_dimension };
+    result.outsiders = outsiders;
+    for (const auto& entity : outsiders) {
+      result.index = result.index.set(entity.key, outside);
+    }
+    copy_subtree(0, result, 0);
+    return result;
+  }
+
+  state_map<Key, std::uint32_t> index;
+  state_flex_vector<Entity> outsiders;
+  std::uint32_t splits_since_compact = 0;
+
+private:
+  void copy_subtree(std::uint32_t from, flat_quad_tree& to, std::uint32_t into) const
+  {
+    const auto& source = node(from);
+    if (source.leaf()) {
+      const auto* entities = bucket(from);
+      auto* copies = to.writable_bucket(into);
+      for (auto i = std::uint32_t{ 0 }; i < source.count; ++i) {
+        copies[i] = entities[i];
+        to.index = to.index.set(entities[i].key, into);
+      }
+      to.writable_node(into).count = source.count;
+      return;
+    }
+    // Allocating the children before descending into them gives every subtree a contiguous range of nodes
+    const auto first = to.allocate_block();
+    for (auto q = 0; q < 4; ++q) {
+      const auto& boundary = node(source.first_child + q).boundary;
+      to.writable_node(first + q) = node_type{ boundary, into, no_children, source.depth + 1, 0 };
+    }
+    to.writable_node(into).first_child = first;
+    for (std::uint32_t q = 0; q < 4; ++q) {
+      copy_subtree(source.first_child + q, to, first + q);
+    }
+  }
+
+  page_type& writable_page(std::size_t p)
+  {
+    auto& page = pages[p];
+    if (page.use_count() > 1) {
+      page = std::make_shared<page_type>(*page);
+    } else {
+      // use_count() is a relaxed load: a copy that let go of the page on another thread, e.g. a snapshot, may still
+      // have reads of it in flight that must happen before the writes below
+      std::atomic_thread_fence(std::memory_order_acquire);
+    }
+    return *page;
+  }
+
+  // Four consecutive nodes, never straddling a page since page_size is a multiple of four
+  std::uint32_t allocate_block()
+  {
+    const auto first = (allocated + 3) / 4 * 4;
+    allocated = first + 4;
+    while (pages.size() * page_size < allocated) {
+      pages.push_back(std::make_shared<page_type>());
+    }
+    return first;
+  }
+
+  void split(std::uint32_t n)
+  {
+    const auto first = allocate_block();
+    const auto parent = node(n);
+    for (auto q = 0; q < 4; ++q) {
+      auto& child = writable_node(first + q);
+      child = node_type{ parent.boundary.quadrant(q), n, no_children, parent.depth + 1, 0 };
+    }
+    auto& split_node = writable_node(n);
+    split_node.first_child = first;
+    split_node.count = 0;
+    const auto* entities = bucket(n);
+    for (auto i = std::uint32_t{ 0 }; i < parent.count; ++i) {
+      const auto c = first + parent.boundary.quadrant_of(entities[i].position);
+      auto& child = writable_node(c);
+      writable_bucket(c)[child.count++] = entities[i];
+      index = index.set(entities[i].key, c);
+    }
+    ++splits_since_compact;
+  }
+
+  static_assert(page_size % 4 == 0, "a block of four children must not straddle pages");
+
+  std::vector<std::shared_ptr<page_type>> pages;
+  std::uint32_t allocated = 1;
+};
+
+// Insert an entity into the qtree, replacing the entity with the same key if there is one
+template<typename T, typename Key>
+flat_quad_tree<T, Key>
+insert(flat_quad_tree<T, Key> qtree, Key key, T payload, tensor<meter_t> position)
+{
+  qtree.take(key);
+  qtree.place(0, { std::move(key), position, std::move(payload) });
+  // Splits append nodes at the end, compacting once they make up half of the tree keeps it in Morton order
+  if (qtree.splits_since_compact * 8 > qtree.node_count()) {
+    qtree = qtree.compacted();
+  }
+  return qtree;
+}
+
+// Call visitor with every entity in range, without collecting them anywhere
+template<typename T, typename Key, typename Visitor>
+void
+visit(const flat_quad_tree<T, Key>& qtree, typename flat_quad_tree<T, Key>::BoundingBox range, Visitor&& visitor)
+{
+  for (const auto& entity : qtree.outsiders) {
+    if (range.contains(entity.position)) {
+      visitor(entity);
+    }
+  }
+  if (!qtree.node(0).boundary.intersects(range)) {
+    return;
+  }
+  // Every level pushes at most four nodes and pops one
+  auto stack = std::array<std::uint32_t, 3 * flat_quad_tree<T, Key>::max_depth + 4>{};
+  auto top = std::size_t{ 0 };
+  stack[top++] = 0;
+  while (top > 0) {
+    const auto n = stack[--top];
+    const auto& node = qtree.node(n);
+    if (node.leaf()) {
+      const auto* entities = qtree.bucket(n);
+      for (auto i = std::uint32_t{ 0 }; i < node.count; ++i) {
+        if (range.contains(entities[i].position)) {
+          visitor(entities[i]);
+        }
+      }
+      continue;
+    }
+    for (auto q = 4; q-- > 0;) {
+      if (qtree.node(node.first_child + q).boundary.intersects(range)) {
+        stack[top++] = node.first_child + q;
+      }
+    }
+  }
+}
+
+// Call visitor with every entity in the qtree
+template<typename T, typename Key, typename Visitor>
+void
+visit(const flat_quad_tree<T, Key>& qtree, Visitor&& visitor)
+{
+  for (const auto& entity : qtree.outsiders) {
+    visitor(entity);
+  }
+  for (auto n = std::uint32_t{ 0 }; n < qtree.node_count(); ++n) {
+    const auto* entities = qtree.bucket(n);
+    for (auto i = std::uint32_t{ 0 }; i < qtree.node(n).count; ++i) {
+      visitor(entities[i]);
+    }
+  }
+}
+
+// Query the qtree
+template<typename T, typename Key>
+state_vector<typename flat_quad_tree<T, Key>::Entity>
+query(const flat_quad_tree<T, Key>& qtree, typename flat_quad_tree<T, Key>::BoundingBox range)
+{
+  auto entities = state_vector<typename flat_quad_tree<T, Key>::Entity>{}.transient();
+  visit(qtree, range, [&entities](const auto& entity) { entities.push_back(entity); });
+  return entities.persistent();
+}
+
+// Query the qtree, writing the entities in range to out
+template<typename T, typename Key, typename OutputIt>
+OutputIt
+query(const flat_quad_tree<T, Key>& qtree, typename flat_quad_tree<T, Key>::BoundingBox range, OutputIt out)
+{
+  visit(qtree, range, [&out](const auto& entity) { *out++ = entity; });
+  return out;
+}
+
+// Look up an entity by key, null if there is none
+template<typename T, typename Key>
+const typename flat_quad_tree<T, Key>::Entity*
+find(const flat_quad_tree<T, Key>& qtree, const Key& key)
+{
+  const auto* n = qtree.index.find(key);
+  if (!n) {
+    return nullptr;
+  }
+  if (*n == flat_quad_tree<T, Key>::outside) {
+    for (const auto& entity : qtree.outsiders) {
+      if (entity.key == key) {
+        return &entity;
+      }
+    }
+    return nullptr;
+  }
+  const auto* entities = qtree.bucket(*n);
+  for (auto i = std::uint32_t{ 0 }; i < qtree.node(*n).count; ++i) {
+    if (entities[i].key == key) {
+      return &entities[i];
+    }
+  }
+  return nullptr;
+}
+
+// Remove the entity with the given key, if there is one
+template<typename T, typename Key>
+flat_quad_tree<T, Key>
+remove(flat_quad_tree<T, Key> qtree, const Key& key)
+{
+  qtree.take(key);
+  return qtree;
+}
+
+// Move the entity with the given key, if there is one. An entity that stays inside its leaf is updated where it is,
+// otherwise it is put below the nearest ancestor of its leaf that contains the destination.
+template<typename T, typename Key>
+flat_quad_tree<T, Key>
+move(flat_quad_tree<T, Key> qtree, const Key& key, tensor<meter_t> destination)
+{
+  const auto* found = qtree.index.find(key);
+  if (!found) {
+    return qtree;
+  }
+  const auto n = *found;
+  if (n != flat_quad_tree<T, Key>::outside && qtree.node(n).boundary.contains(destination)) {
+    auto* entities = qtree.writable_bucket(n);
+    for (auto i = std::uint32_t{ 0 }; i < qtree.node(n).count; ++i) {
+      if (entities[i].key == key) {
+        entities[i].position = destination;
+        break;
+      }
+    }
+    return qtree;
+  }
+
+  auto entity = *qtree.take(key);
+  entity.position = destination;
+  auto ancestor = n == flat_quad_tree<T, Key>::outside ? 0 : n;
+  while (ancestor != 0 && !qtree.node(ancestor).boundary.contains(destination)) {
+    ancestor = qtree.node(ancestor).parent;
+  }
+  qtree.place(ancestor, std::move(entity));
+  return qtree;
+}
+
+// Write the k entities nearest to point to out, nearest first
+template<typename T, typename Key, typename OutputIt>
+OutputIt
+nearest(const flat_quad_tree<T, Key>& qtree, tensor<meter_t> point, std::size_t k, OutputIt out)
+{
+  using entity_type = typename flat_quad_tree<T, Key>::Entity;
+  if (k == 0) {
+    return out;
+  }
+
+  auto frontier = std::vector<std::pair<double, std::uint32_t>>{ { 0.0, 0 } };
+  auto best = std::vector<std::pair<double, const entity_type*>>{};
+  const auto farther = [](const auto& a, const auto& b) { return a.first > b.first; };
+  const auto closer = [](const auto& a, const auto& b) { return a.first < b.first; };
+  const auto bound = [&] { return best.size() < k ? std::numeric_limits<double>::infinity() : best.front().first; };
+  const auto consider = [&](const entity_type& entity) {
+    const auto d = detail::squared_distance(entity.position, point);
+    if (best.size() < k) {
+      best.emplace_back(d, &entity);
+      std::push_heap(best.begin(), best.end(), closer);
+    } else if (d < best.front().first) {
+      std::pop_heap(best.begin(), best.end(), closer);
+      best.back() = { d, &entity };
+      std::push_heap(best.begin(), best.end(), closer);
+    }
+  };
+
+  for (const auto& entity : qtree.outsiders) {
+    consider(entity);
+  }
+  while (!frontier.empty()) {
+    std::pop_heap(frontier.begin(), frontier.end(), farther);
+    const auto [distance, n] = frontier.back();
+    frontier.pop_back();
+    if (distance > bound()) {
+      break;
+    }
+    const auto& node = qtree.node(n);
+    if (node.leaf()) {
+      const auto* entities = qtree.bucket(n);
+      for (auto i = std::uint32_t{ 0 }; i < node.count; ++i) {
+        consider(entities[i]);
+      }
+      continue;
+    }
+    for (auto q = 0; q < 4; ++q) {
+      const auto child = node.first_child + q;
+      const auto d = detail::squared_distance(qtree.node(child).boundary, point);
+      if (d <= bound()) {
+        frontier.emplace_back(d, child);
+        std::push_heap(frontier.begin(), frontier.end(), farther);
+      }
+    }
+  }
+
+  std::sort_heap(best.begin(), best.end(), closer);
+  for (const auto& [distance, entity] : best) {
+    *out++ = *entity;
+  }
+  return out;
+}
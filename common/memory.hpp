@@ -0,0 +1,87 @@
+#pragma once
+#include <immer/box.hpp>
+#include <immer/flex_vector.hpp>
+#include <immer/heap/cpp_heap.hpp>
+#include <immer/heap/heap_policy.hpp>
+#include <immer/map.hpp>
+#include <immer/memory_policy.hpp>
+#include <immer/vector.hpp>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+
+//////////////////////////////////////////////////////////////////////////////
+// Allocation counters
+//////////////////////////////////////////////////////////////////////////////
+
+struct allocation_counters
+{
+  std::size_t allocations = 0;
+  std::size_t deallocations = 0;
+  std::size_t bytes = 0;
+
+  allocation_counters operator-(const allocation_counters& other) const
+  {
+    return { allocations - other.allocations, deallocations - other.deallocations, bytes - other.bytes };
+  }
+};
+
+namespace detail {
+inline std::atomic<std::size_t> allocations{ 0 };
+inline std::atomic<std::size_t> deallocations{ 0 };
+inline std::atomic<std::size_t> allocated_bytes{ 0 };
+} // namespace detail
+
+// Totals since the start of the program, for all state containers on all threads. Take two snapshots and subtract
+// them to count the allocations of a tick.
+inline allocation_counters
+allocation_snapshot()
+{
+  return { detail::allocations.load(std::memory_order_relaxed),
+           detail::deallocations.load(std::memory_order_relaxed),
+           detail::allocated_bytes.load(std::memory_order_relaxed) };
+}
+
+// counting_heap :: immer heap that forwards to Heap and counts what reaches it
+//
+// Placed below the free lists, so it only counts the allocations that the pool could not serve.
+template<typename Heap>
+struct counting_heap
+{
+  template<typename... Tags>
+  static void* allocate(std::size_t size, Tags... tags)
+  {
+    detail::allocations.fetch_add(1, std::memory_order_relaxed);
+    detail::allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    return Heap::allocate(size, tags...);
+  }
+
+  template<typename... Tags>
+  static void deallocate(std::size_t size, void* data, Tags... tags)
+  {
+    detail::deallocations.fetch_add(1, std::memory_order_relaxed);
+    Heap::deallocate(size, data, tags...);
+  }
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// State containers
+//////////////////////////////////////////////////////////////////////////////
+
+// Memory policy of every immer container in aggregate state. Freed nodes go to a thread-local free list, backed by a
+// global one, so steady-state ticks recycle nodes instead of going through malloc/free.
+using state_memory_policy = immer::memory_policy<immer::free_list_heap_policy<counting_heap<immer::cpp_heap>>,
+                                                 immer::default_refcount_policy,
+                                                 immer::default_lock_policy>;
+
+template<typename K, typename T, typename Hash = std::hash<K>, typename Equal = std::equal_to<K>>
+using state_map = immer::map<K, T, Hash, Equal, state_memory_policy>;
+
+template<typename T>
+using state_vector = immer::vector<T, state_memory_policy>;
+
+template<typename T>
+using state_flex_vector = immer::flex_vector<T, state_memory_policy>;
+
+template<typename T>
+using state_box = immer::box<T, state_memory_policy>;
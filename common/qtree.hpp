@@ -1,21 +1,36 @@
 #pragma once
+#include "memory.hpp"
 #include "units.hpp"
-#include <immer/box.hpp>
-#include <immer/flex_vector.hpp>
-#include <immer/vector.hpp>
+#include <immer/vector_transient.hpp>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
 #include <optional>
+#include <utility>
+#include <vector>
 
-template<typename T>
+// Loose quad tree
+//
+// An entity is stored in the node whose boundary contained it when it was inserted, or in the root if it is outside
+// of the root. The loose boundary of a node is its boundary grown to twice the size, and an entity stays in its node
+// for as long as it is inside the loose boundary, so small moves update the entity where it is instead of removing and
+// reinserting it. Queries test the loose boundaries of the children before descending into them.
+//
+// Every entity has a key, and an index maps the key to the path of the node that holds the entity, so lookups and
+// moves go straight to the node instead of searching for the entity.
+template<typename T, typename Key>
 struct QuadTreeImpl;
-template<typename T>
-using quad_tree = immer::box<QuadTreeImpl<T>>;
 
-template<typename T>
+template<typename T, typename Key = int>
+struct quad_tree;
+
+template<typename T, typename Key>
 struct QuadTreeImpl
 {
-
   struct Entity
   {
+    Key key;
     tensor<meter_t> position;
     T payload;
   };
@@ -39,250 +54,447 @@ struct QuadTreeImpl
       return !(other.center.x - other.half_dimension > x + w || other.center.x + other.half_dimension < x - w ||
                other.center.y - other.half_dimension > y + w || other.center.y + other.half_dimension < y - w);
     }
+
+    BoundingBox loose() const { return { center, half_dimension * 2.0 }; }
+
+    // Quadrants are numbered northwest, northeast, southwest, southeast
+    int quadrant_of(tensor<meter_t> position) const
+    {
+      return (position.x >= center.x ? 1 : 0) | (position.y >= center.y ? 2 : 0);
+    }
+
+    BoundingBox quadrant(int q) const
+    {
+      const auto w = half_dimension / 2.0;
+      return { { center.x + ((q & 1) ? w : -w), center.y + ((q & 2) ? w : -w) }, w };
+    }
   };
 
   BoundingBox boundary;
   int capacity;
   bool subdivided = false;
-  immer::flex_vector<Entity> entities;
-  std::optional<immer::box<QuadTreeImpl>> northwest;
-  std::optional<immer::box<QuadTreeImpl>> northeast;
-  std::optional<immer::box<QuadTreeImpl>> southwest;
-  std::optional<immer::box<QuadTreeImpl>> southeast;
+  state_flex_vector<Entity> entities;
+  std::array<std::optional<state_box<QuadTreeImpl>>, 4> children;
 
   QuadTreeImpl(meter_t x = 0_m, meter_t y = 0_m, meter_t half_dimension = 1000_m, int capacity = 4)
-      : boundary{ x, y, half_dimension }
+      : boundary{ { x, y }, half_dimension }
+      , capacity{ capacity }
+  {}
+
+  QuadTreeImpl(BoundingBox boundary, int capacity)
+      : boundary{ boundary }
       , capacity{ capacity }
   {}
 };
 
-template<typename T>
-quad_tree<T>
-subdivide(quad_tree<T> qtree)
+namespace detail {
+
+// Path from the root to a node, two bits per level with the first level in the lowest bits
+struct qtree_path
 {
-  return qtree.update([](auto qtree) {
-    const auto x = qtree.boundary.center.x;
-    const auto y = qtree.boundary.center.y;
-    const auto w = qtree.boundary.half_dimension;
-    const auto c = qtree.capacity;
-    qtree.northwest = quad_tree<T>(x - w / 2.0f, y - w / 2.0f, w / 2.0f, c);
-    qtree.northeast = quad_tree<T>(x + w / 2.0f, y - w / 2.0f, w / 2.0f, c);
-    qtree.southwest = quad_tree<T>(x - w / 2.0f, y + w / 2.0f, w / 2.0f, c);
-    qtree.southeast = quad_tree<T>(x + w / 2.0f, y + w / 2.0f, w / 2.0f, c);
-    qtree.subdivided = true;
-    return qtree;
-  });
-}
+  static constexpr int max_depth = 31;
+
+  std::uint64_t quadrants = 0;
+  int depth = 0;
 
-// Insert an entity into the qtree
-template<typename T>
-quad_tree<T>
-insert(quad_tree<T> qtree, T payload, tensor<meter_t> position);
+  int quadrant(int level) const { return static_cast<int>((quadrants >> (2 * level)) & 3); }
+
+  qtree_path child(int q) const { return { quadrants | (static_cast<std::uint64_t>(q) << (2 * depth)), depth + 1 }; }
+
+  qtree_path prefix(int level) const
+  {
+    return { level == 0 ? 0 : quadrants & (~std::uint64_t{ 0 } >> (64 - 2 * level)), level };
+  }
+};
+
+} // namespace detail
+
+template<typename T, typename Key>
+struct quad_tree
+{
+  using node_type = QuadTreeImpl<T, Key>;
+  using Entity = typename node_type::Entity;
+  using BoundingBox = typename node_type::BoundingBox;
+
+  state_box<node_type> root;
+  state_map<Key, detail::qtree_path> index;
+
+  quad_tree(meter_t x = 0_m, meter_t y = 0_m, meter_t half_dimension = 1000_m, int capacity = 4)
+      : root{ node_type{ x, y, half_dimension, capacity } }
+  {}
+
+  std::size_t size() const { return index.size(); }
+
+  // Boundary of the node at the end of path, worked out from the root without visiting the nodes in between
+  BoundingBox boundary(const detail::qtree_path& path) const
+  {
+    auto box = root->boundary;
+    for (auto level = 0; level < path.depth; ++level) {
+      box = box.quadrant(path.quadrant(level));
+    }
+    return box;
+  }
+};
+
+// Insert an entity into the qtree, replacing the entity with the same key if there is one
+template<typename T, typename Key>
+quad_tree<T, Key>
+insert(quad_tree<T, Key> qtree, Key key, T payload, tensor<meter_t> position);
 
 // Query the qtree
-template<typename T>
-immer::vector<typename quad_tree<T>::Entity>
-query(quad_tree<T> qtree, typename quad_tree<T>::BoundingBox range);
+template<typename T, typename Key>
+state_vector<typename quad_tree<T, Key>::Entity>
+query(const quad_tree<T, Key>& qtree, typename quad_tree<T, Key>::BoundingBox range);
+
+// Query the qtree, writing the entities in range to out
+template<typename T, typename Key, typename OutputIt>
+OutputIt
+query(const quad_tree<T, Key>& qtree, typename quad_tree<T, Key>::BoundingBox range, OutputIt out);
+
+// Call visitor with every entity in range, without collecting them anywhere
+template<typename T, typename Key, typename Visitor>
+void
+visit(const quad_tree<T, Key>& qtree, typename quad_tree<T, Key>::BoundingBox range, Visitor&& visitor);
+
+// Call visitor with every entity in the qtree
+template<typename T, typename Key, typename Visitor>
+void
+visit(const quad_tree<T, Key>& qtree, Visitor&& visitor);
+
+// Write the k entities nearest to point to out, nearest first
+template<typename T, typename Key, typename OutputIt>
+OutputIt
+nearest(const quad_tree<T, Key>& qtree, tensor<meter_t> point, std::size_t k, OutputIt out);
+
+// Look up an entity by key, null if there is none
+template<typename T, typename Key>
+const typename quad_tree<T, Key>::Entity*
+find(const quad_tree<T, Key>& qtree, const Key& key);
+
+// Remove the entity with the given key, if there is one
+template<typename T, typename Key>
+quad_tree<T, Key>
+remove(quad_tree<T, Key> qtree, const Key& key);
+
+// Move the entity with the given key, if there is one
+template<typename T, typename Key>
+quad_tree<T, Key>
+move(quad_tree<T, Key> qtree, const Key& key, tensor<meter_t> destination);
 
 ////////////////////////////////////////////////////////////////////////////////
 // Implementation details follow
 ////////////////////////////////////////////////////////////////////////////////
 
 namespace detail {
-template<typename T>
-std::optional<quad_tree<T>>
-insert_impl(quad_tree<T> qtree, T payload, tensor<meter_t> position)
-{
-  // Ignore objects that do not belong to this quad tree
-  if (!qtree->boundary.contains(position)) {
-    return {};
-  }
 
-  // If there is space in this quad tree and if it doesn't have subdivisions,
-  // add the object here
-  if (qtree->entities.size() < qtree->capacity) {
-    return qtree.update([payload, position](auto qtree) {
-      qtree.entities = qtree.entities.push_back({ position, payload });
-      return qtree;
-    });
-  }
+template<typename T, typename Key>
+using qtree_node = state_box<QuadTreeImpl<T, Key>>;
 
-  if (!qtree->subdivided) {
-    qtree = subdivide(qtree);
+// Replaces the node at the end of path by fn(node), copying the nodes above it
+template<typename T, typename Key, typename F>
+qtree_node<T, Key>
+replace_at(const qtree_node<T, Key>& node, const qtree_path& path, int level, F&& fn)
+{
+  if (level == path.depth) {
+    return fn(node);
   }
-
-  bool done = false;
-
-  qtree = qtree.update([payload, position, &done](auto qtree) {
-    if (auto nw = insert_impl(*qtree.northwest, payload, position)) {
-      qtree.northwest = nw;
-      done = true;
-    }
-    return qtree;
+  return node.update([&](auto copy) {
+    auto& child = copy.children[path.quadrant(level)];
+    child = replace_at(*child, path, level + 1, fn);
+    return copy;
   });
-  if (done) {
-    return qtree;
-  }
+}
 
-  qtree = qtree.update([payload, position, &done](auto qtree) {
-    if (auto ne = insert_impl(*qtree.northeast, payload, position)) {
-      qtree.northeast = ne;
-      done = true;
+template<typename T, typename Key>
+qtree_node<T, Key>
+subdivide(const qtree_node<T, Key>& node)
+{
+  return node.update([](auto copy) {
+    for (auto q = 0; q < 4; ++q) {
+      copy.children[q] = qtree_node<T, Key>{ QuadTreeImpl<T, Key>{ copy.boundary.quadrant(q), copy.capacity } };
     }
-    return qtree;
+    copy.subdivided = true;
+    return copy;
   });
-  if (done) {
-    return qtree;
-  }
+}
 
-  qtree = qtree.update([payload, position, &done](auto qtree) {
-    if (auto sw = insert_impl(*qtree.southwest, payload, position)) {
-      qtree.southwest = sw;
-      done = true;
-    }
-    return qtree;
-  });
-  if (done) {
-    return qtree;
+// Inserts below node, which is at path, and sets placed to the path of the node the entity ended up in. Entities
+// already in a node stay there when it is subdivided, so the paths in the index never go stale.
+template<typename T, typename Key>
+qtree_node<T, Key>
+insert_impl(qtree_node<T, Key> node,
+            const qtree_path& path,
+            typename QuadTreeImpl<T, Key>::Entity entity,
+            qtree_path& placed)
+{
+  const auto full = node->entities.size() >= static_cast<std::size_t>(node->capacity);
+  if ((!node->subdivided && !full) || path.depth == qtree_path::max_depth ||
+      !node->boundary.contains(entity.position)) {
+    placed = path;
+    return node.update([&entity](auto copy) {
+      copy.entities = copy.entities.push_back(std::move(entity));
+      return copy;
+    });
   }
 
-  qtree = qtree.update([payload, position, &done](auto qtree) {
-    if (auto se = insert_impl(*qtree.southeast, payload, position)) {
-      qtree.southeast = se;
-      done = true;
-    }
-    return qtree;
-  });
-  if (!done) {
-    throw std::runtime_error{ "Failed to insert into qtree" };
+  if (!node->subdivided) {
+    node = subdivide(node);
   }
 
-  return qtree;
+  const auto q = node->boundary.quadrant_of(entity.position);
+  return node.update([&](auto copy) {
+    copy.children[q] = insert_impl(*copy.children[q], path.child(q), std::move(entity), placed);
+    return copy;
+  });
 }
 
-template<typename T, typename F>
-std::optional<quad_tree<T>>
-remove_impl(quad_tree<T> qtree, typename QuadTreeImpl<T>::BoundingBox range, F&& predicate)
+template<typename T, typename Key>
+std::optional<std::size_t>
+slot_of(const QuadTreeImpl<T, Key>& node, const Key& key)
 {
-  if (!qtree->boundary.intersects(range)) {
-    return {};
-  }
-  auto i = 0;
-  for (const auto& entity : qtree->entities) {
-    if (predicate(entity.payload)) {
-      return qtree.update([&i](auto qtree) {
-        qtree.entities = qtree.entities.erase(i);
-        return qtree;
-      });
+  auto i = std::size_t{ 0 };
+  for (const auto& entity : node.entities) {
+    if (entity.key == key) {
+      return i;
     }
     ++i;
   }
-  if (qtree->northwest) {
-    if (auto nw = remove_impl(*qtree->northwest, range, predicate)) {
-      return qtree.update([nw](auto qtree) {
-        qtree.northwest = nw;
-        return qtree;
-      });
-    }
+  return std::nullopt;
+}
+
+template<typename T, typename Key>
+const QuadTreeImpl<T, Key>&
+node_at(const quad_tree<T, Key>& qtree, const qtree_path& path)
+{
+  const auto* node = &*qtree.root;
+  for (auto level = 0; level < path.depth; ++level) {
+    node = &**node->children[path.quadrant(level)];
   }
-  if (qtree->northeast) {
-    if (auto ne = remove_impl(*qtree->northeast, range, predicate)) {
-      return qtree.update([ne](auto qtree) {
-        qtree.northeast = ne;
-        return qtree;
-      });
+  return *node;
+}
+
+template<typename T, typename Key, typename Visitor>
+void
+visit_impl(const QuadTreeImpl<T, Key>& node, const typename QuadTreeImpl<T, Key>::BoundingBox& range, Visitor& visitor)
+{
+  for (const auto& entity : node.entities) {
+    if (range.contains(entity.position)) {
+      visitor(entity);
     }
   }
-  if (qtree->southwest) {
-    if (auto sw = remove_impl(*qtree->southwest, range, predicate)) {
-      return qtree.update([sw](auto qtree) {
-        qtree.southwest = sw;
-        return qtree;
-      });
+  for (const auto& child : node.children) {
+    if (child && (*child)->boundary.loose().intersects(range)) {
+      visit_impl(**child, range, visitor);
     }
   }
-  if (qtree->southeast) {
-    if (auto se = remove_impl(*qtree->southeast, range, predicate)) {
-      return qtree.update([se](auto qtree) {
-        qtree.southeast = se;
-        return qtree;
-      });
+}
+
+template<typename T, typename Key, typename Visitor>
+void
+visit_all(const QuadTreeImpl<T, Key>& node, Visitor& visitor)
+{
+  for (const auto& entity : node.entities) {
+    visitor(entity);
+  }
+  for (const auto& child : node.children) {
+    if (child) {
+      visit_all(**child, visitor);
     }
   }
-  return {};
 }
+
+inline double
+squared_distance(tensor<meter_t> a, tensor<meter_t> b)
+{
+  const auto dx = (a.x - b.x).to<double>();
+  const auto dy = (a.y - b.y).to<double>();
+  return dx * dx + dy * dy;
+}
+
+// Squared distance from point to the closest point of box, zero inside
+template<typename BoundingBox>
+double
+squared_distance(const BoundingBox& box, tensor<meter_t> point)
+{
+  const auto dx = std::max(abs(point.x - box.center.x) - box.half_dimension, 0_m).template to<double>();
+  const auto dy = std::max(abs(point.y - box.center.y) - box.half_dimension, 0_m).template to<double>();
+  return dx * dx + dy * dy;
+}
+
 } // namespace detail
 
-template<typename T>
-quad_tree<T>
-insert(quad_tree<T> qtree, T payload, tensor<meter_t> position)
+template<typename T, typename Key>
+quad_tree<T, Key>
+insert(quad_tree<T, Key> qtree, Key key, T payload, tensor<meter_t> position)
+{
+  if (qtree.index.find(key)) {
+    qtree = remove(std::move(qtree), key);
+  }
+  auto placed = detail::qtree_path{};
+  qtree.root = detail::insert_impl(
+    qtree.root, detail::qtree_path{}, typename quad_tree<T, Key>::Entity{ key, position, std::move(payload) }, placed);
+  qtree.index = qtree.index.set(std::move(key), placed);
+  return qtree;
+}
+
+template<typename T, typename Key>
+state_vector<typename quad_tree<T, Key>::Entity>
+query(const quad_tree<T, Key>& qtree, typename quad_tree<T, Key>::BoundingBox range)
+{
+  auto entities = state_vector<typename quad_tree<T, Key>::Entity>{}.transient();
+  visit(qtree, range, [&entities](const auto& entity) { entities.push_back(entity); });
+  return entities.persistent();
+}
+
+template<typename T, typename Key, typename OutputIt>
+OutputIt
+query(const quad_tree<T, Key>& qtree, typename quad_tree<T, Key>::BoundingBox range, OutputIt out)
+{
+  visit(qtree, range, [&out](const auto& entity) { *out++ = entity; });
+  return out;
+}
+
+template<typename T, typename Key, typename Visitor>
+void
+visit(const quad_tree<T, Key>& qtree, typename quad_tree<T, Key>::BoundingBox range, Visitor&& visitor)
 {
-  return *detail::insert_impl(qtree, payload, position);
+  detail::visit_impl(*qtree.root, range, visitor);
 }
 
-template<typename T>
-immer::vector<typename QuadTreeImpl<T>::Entity>
-query(quad_tree<T> qtree, typename QuadTreeImpl<T>::BoundingBox range)
+template<typename T, typename Key, typename Visitor>
+void
+visit(const quad_tree<T, Key>& qtree, Visitor&& visitor)
 {
-  immer::vector<typename QuadTreeImpl<T>::Entity> entities;
-  if (!qtree->boundary.intersects(range)) {
-    return entities;
+  detail::visit_all(*qtree.root, visitor);
+}
+
+// Best-first search: nodes are expanded closest first, and the search ends when the closest node left is farther
+// away than the k-th best entity found so far.
+template<typename T, typename Key, typename OutputIt>
+OutputIt
+nearest(const quad_tree<T, Key>& qtree, tensor<meter_t> point, std::size_t k, OutputIt out)
+{
+  using node_type = QuadTreeImpl<T, Key>;
+  using entity_type = typename node_type::Entity;
+  if (k == 0) {
+    return out;
   }
-  for (const auto& entity : qtree->entities) {
-    if (range.contains(entity.position)) {
-      entities = entities.push_back(entity);
+
+  auto frontier = std::vector<std::pair<double, const node_type*>>{ { 0.0, &*qtree.root } };
+  auto best = std::vector<std::pair<double, const entity_type*>>{};
+  const auto farther = [](const auto& a, const auto& b) { return a.first > b.first; };
+  const auto closer = [](const auto& a, const auto& b) { return a.first < b.first; };
+  const auto bound = [&] { return best.size() < k ? std::numeric_limits<double>::infinity() : best.front().first; };
+
+  while (!frontier.empty()) {
+    std::pop_heap(frontier.begin(), frontier.end(), farther);
+    const auto [distance, node] = frontier.back();
+    frontier.pop_back();
+    if (distance > bound()) {
+      break;
     }
-  }
-  if (qtree->northwest) {
-    for (const auto& entity : query(*qtree->northwest, range)) {
-      entities = entities.push_back(entity);
+    for (const auto& entity : node->entities) {
+      const auto d = detail::squared_distance(entity.position, point);
+      if (best.size() < k) {
+        best.emplace_back(d, &entity);
+        std::push_heap(best.begin(), best.end(), closer);
+      } else if (d < best.front().first) {
+        std::pop_heap(best.begin(), best.end(), closer);
+        best.back() = { d, &entity };
+        std::push_heap(best.begin(), best.end(), closer);
+      }
     }
-  }
-  if (qtree->northeast) {
-    for (const auto& entity : query(*qtree->northeast, range)) {
-      entities = entities.push_back(entity);
+    for (const auto& child : node->children) {
+      if (child) {
+        const auto d = detail::squared_distance((*child)->boundary.loose(), point);
+        if (d <= bound()) {
+          frontier.emplace_back(d, &**child);
+          std::push_heap(frontier.begin(), frontier.end(), farther);
+        }
+      }
     }
   }
-  if (qtree->southwest) {
-    for (const auto& entity : query(*qtree->southwest, range)) {
-      entities = entities.push_back(entity);
-    }
+
+  std::sort_heap(best.begin(), best.end(), closer);
+  for (const auto& [distance, entity] : best) {
+    *out++ = *entity;
   }
-  if (qtree->southeast) {
-    for (const auto& entity : query(*qtree->southeast, range)) {
-      entities = entities.push_back(entity);
+  return out;
+}
+
+template<typename T, typename Key>
+const typename quad_tree<T, Key>::Entity*
+find(const quad_tree<T, Key>& qtree, const Key& key)
+{
+  if (const auto* path = qtree.index.find(key)) {
+    const auto& node = detail::node_at(qtree, *path);
+    if (const auto slot = detail::slot_of(node, key)) {
+      return &node.entities[*slot];
     }
   }
-  return entities;
+  return nullptr;
 }
 
-template<typename T, typename F>
-quad_tree<T>
-remove(quad_tree<T> qtree, typename QuadTreeImpl<T>::BoundingBox range, F&& predicate)
+template<typename T, typename Key>
+quad_tree<T, Key>
+remove(quad_tree<T, Key> qtree, const Key& key)
 {
-  if (auto result = detail::remove_impl(qtree, std::move(range), std::move(predicate))) {
-    return *result;
+  const auto* path = qtree.index.find(key);
+  if (!path) {
+    return qtree;
   }
-  return std::move(qtree);
+  qtree.root = detail::replace_at(qtree.root, *path, 0, [&key](const auto& node) {
+    return node.update([&key](auto copy) {
+      if (const auto slot = detail::slot_of(copy, key)) {
+        copy.entities = copy.entities.erase(*slot);
+      }
+      return copy;
+    });
+  });
+  qtree.index = qtree.index.erase(key);
+  return qtree;
 }
 
-template<typename T, typename F>
-quad_tree<T>
-move(quad_tree<T> qtree, tensor<meter_t> destination, meter_t search_width, F&& predicate)
+// An entity that is still inside the loose boundary of its node is updated in place, otherwise it is taken out and
+// reinserted below the nearest node on its path that contains the destination.
+template<typename T, typename Key>
+quad_tree<T, Key>
+move(quad_tree<T, Key> qtree, const Key& key, tensor<meter_t> destination)
 {
-  T pl;
-  auto pred = [&pl, &predicate](const auto& payload) mutable {
-    // store payload for later use
-    if (predicate(payload)) {
-      pl = payload;
-      return true;
-    }
-    return false;
-  };
-  auto range = typename QuadTreeImpl<T>::BoundingBox{ destination, search_width };
-  if (auto removed = detail::remove_impl(qtree, range, std::move(pred))) {
-    std::cout << "Move " << destination << std::endl;
-    return insert(*removed, std::move(pl), destination);
+  const auto* found = qtree.index.find(key);
+  if (!found) {
+    return qtree;
   }
+  const auto path = *found;
+
+  if (path.depth == 0 || qtree.boundary(path).loose().contains(destination)) {
+    qtree.root = detail::replace_at(qtree.root, path, 0, [&](const auto& node) {
+      return node.update([&](auto copy) {
+        if (const auto slot = detail::slot_of(copy, key)) {
+          copy.entities = copy.entities.update(*slot, [&destination](auto entity) {
+            entity.position = destination;
+            return entity;
+          });
+        }
+        return copy;
+      });
+    });
+    return qtree;
+  }
+
+  auto level = path.depth - 1;
+  while (level > 0 && !qtree.boundary(path.prefix(level)).contains(destination)) {
+    --level;
+  }
+  const auto ancestor = path.prefix(level);
+
+  auto entity = *find(qtree, key);
+  entity.position = destination;
+  qtree = remove(std::move(qtree), key);
+  auto placed = detail::qtree_path{};
+  qtree.root = detail::replace_at(qtree.root, ancestor, 0, [&](const auto& node) {
+    return detail::insert_impl(node, ancestor, std::move(entity), placed);
+  });
+  qtree.index = qtree.index.set(key, placed);
   return qtree;
 }
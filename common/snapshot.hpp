@@ -0,0 +1,119 @@
+#pragma once
+#include "memory.hpp"
+#include <event-sauce/snapshot/snapshot.hpp>
+#include <immer/algorithm.hpp>
+#include <immer/map_transient.hpp>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <type_traits>
+#include <vector>
+
+// Snapshot codec for maps in aggregate state.
+//
+// A delta is computed with immer::diff, which compares the two versions node by node and skips every subtree they
+// share, so its cost follows the number of entries that changed rather than the size of the map.
+//
+//   full  = u64 count | (key, value)...
+//   delta = u64 upserts | (key, value)... | u64 removals | key...
+template<typename K, typename T>
+struct event_sauce::snapshot_codec<state_map<K, T>>
+{
+  static_assert(std::is_trivially_copyable_v<K> && std::is_trivially_copyable_v<T>,
+                "map snapshots store keys and values as their bytes");
+
+  using map_type = state_map<K, T>;
+
+  template<typename U>
+  static void put(std::vector<unsigned char>& out, const U& value)
+  {
+    const auto* bytes = reinterpret_cast<const unsigned char*>(&value);
+    out.insert(out.end(), bytes, bytes + sizeof(U));
+  }
+
+  template<typename U>
+  static bool take(const unsigned char*& in, const unsigned char* end, U& value)
+  {
+    if (static_cast<std::size_t>(end - in) < sizeof(U)) {
+      return false;
+    }
+    std::memcpy(&value, in, sizeof(U));
+    in += sizeof(U);
+    return true;
+  }
+
+  static void write(const map_type& state, std::vector<unsigned char>& out)
+  {
+    put(out, static_cast<std::uint64_t>(state.size()));
+    for (const auto& [key, value] : state) {
+      put(out, key);
+      put(out, value);
+    }
+  }
+
+  static std::optional<map_type> read(const unsigned char* in, std::size_t size)
+  {
+    auto state = map_type{};
+    if (!read_delta(state, in, size, false)) {
+      return std::nullopt;
+    }
+    return state;
+  }
+
+  static bool write_delta(const map_type& previous, const map_type& next, std::vector<unsigned char>& out)
+  {
+    auto upserts = std::vector<std::pair<K, T>>{};
+    auto removals = std::vector<K>{};
+    immer::diff(
+      previous,
+      next,
+      [&](const auto& added) { upserts.emplace_back(added.first, added.second); },
+      [&](const auto& removed) { removals.push_back(removed.first); },
+      [&](const auto&, const auto& changed) { upserts.emplace_back(changed.first, changed.second); });
+    if (upserts.empty() && removals.empty()) {
+      return false;
+    }
+    put(out, static_cast<std::uint64_t>(upserts.size()));
+    for (const auto& [key, value] : upserts) {
+      put(out, key);
+      put(out, value);
+    }
+    put(out, static_cast<std::uint64_t>(removals.size()));
+    for (const auto& key : removals) {
+      put(out, key);
+    }
+    return true;
+  }
+
+  static bool read_delta(map_type& state, const unsigned char* in, std::size_t size, bool removals = true)
+  {
+    const auto* end = in + size;
+    auto next = state.transient();
+    auto count = std::uint64_t{};
+    if (!take(in, end, count)) {
+      return false;
+    }
+    for (auto i = std::uint64_t{ 0 }; i < count; ++i) {
+      auto key = K{};
+      auto value = T{};
+      if (!take(in, end, key) || !take(in, end, value)) {
+        return false;
+      }
+      next.set(key, value);
+    }
+    if (removals) {
+      if (!take(in, end, count)) {
+        return false;
+      }
+      for (auto i = std::uint64_t{ 0 }; i < count; ++i) {
+        auto key = K{};
+        if (!take(in, end, key)) {
+          return false;
+        }
+        next.erase(key);
+      }
+    }
+    state = next.persistent();
+    return in == end;
+  }
+};
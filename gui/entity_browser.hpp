@@ -1,5 +1,6 @@
 #pragma once
 
+#include "../common/memory.hpp"
 #include "../mesh/cube.hpp"
 #include "../physics/entity.hpp"
 #include "../render-loop/rendering.hpp"
@@ -45,8 +46,8 @@ struct entity_browser
 
   struct state_type
   {
-    immer::vector<entity_type> entities;
-    immer::vector<cube_type> cubes;
+    state_vector<entity_type> entities;
+    state_vector<cube_type> cubes;
   };
 
   static auto execute(const state_type& state, const draw& cmd) -> std::tuple<std::optional<create_entity_requested>,
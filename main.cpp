@@ -1,3 +1,4 @@
+#include "aggregates/time.hpp"
 #include "gui/entity_browser.hpp"
 #include "opengl/opengl.hpp"
 #include "physics/entity.hpp"
@@ -5,20 +6,17 @@
 #include "render-loop/startup.hpp"
 #include "scheduler/fiber.hpp"
 #include <event-sauce/event-sauce.hpp>
+#include <event-sauce/instrumentation/recorder.hpp>
+#include <csignal>
+#include <future>
 #include <iostream>
 
-struct event_logger
-{
-  struct state_type
-  {};
-
-  template<typename T>
-  static state_type apply(const state_type& state, const T& evt)
-  {
-    std::cout << "EVENT: " << typeid(evt).name() << std::endl;
-    return state;
-  }
-};
+// Build with ENGINE_INSTRUMENTATION to record per-message latency histograms of every stage, dumped to stderr on exit
+#ifdef ENGINE_INSTRUMENTATION
+using instrumentation_type = event_sauce::instrumentation::recorder;
+#else
+using instrumentation_type = event_sauce::instrumentation::none;
+#endif
 
 int
 main()
@@ -26,19 +24,32 @@ main()
   fiber_scheduler scheduler{ 64, 64 };
   auto main_thread = std::async(std::launch::async, [&scheduler] {
     auto projector = opengl{};
-    auto ctx = event_sauce::make_context<render_loop::startup,
-                                         render_loop::input,
-                                         render_loop::physics,
-                                         render_loop::rendering,
-                                         physics::entity,
-                                         mesh::cube,
-                                         gui::entity_browser>();
-    auto dispatch = event_sauce::dispatch(ctx, projector, scheduler);
-    dispatch(render_loop::startup::initiate{});
-    while (true) {
-    }
+    auto ctx = event_sauce::make_instrumented_context<instrumentation_type,
+                                                      render_loop::startup,
+                                                      render_loop::input,
+                                                      render_loop::physics,
+                                                      render_loop::rendering,
+                                                      Time,
+                                                      physics::entity,
+                                                      mesh::cube,
+                                                      gui::entity_browser>();
+    auto engine = event_sauce::make_engine(ctx, projector, scheduler);
+
+    // SIGINT and SIGTERM take the same way out as closing the window: the render loop ends on input::terminated
+    auto terminate = event_sauce::inbox_command<render_loop::input::terminate>{};
+    auto signals = pool_dispatcher{ 1 };
+    signals.install_signal_handler({ SIGINT, SIGTERM }, [&engine, &terminate] { engine.submit(terminate); });
+
+    engine.dispatch()(render_loop::startup::initiate{});
+    engine.run_until(
+      [](const auto& state) { return std::get<render_loop::input::state_type>(state).should_terminate; });
+#ifdef ENGINE_INSTRUMENTATION
+    ctx.instrumentation.dump(std::cerr);
+#endif
+    scheduler.close();
   });
 
   fiber_worker(scheduler, 8).run();
+  main_thread.get();
   return 0;
 }
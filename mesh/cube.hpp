@@ -1,6 +1,6 @@
 #pragma once
+#include "../common/memory.hpp"
 #include "../physics/entity.hpp"
-#include <immer/vector.hpp>
 
 namespace mesh {
 struct cube
@@ -40,7 +40,7 @@ struct cube
     glm::vec3 size;
   };
 
-  using state_type = immer::vector<cube_type>;
+  using state_type = state_vector<cube_type>;
 
   //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
   // EXECUTE
@@ -1,8 +1,40 @@
 #pragma once
 #include "common.hpp"
-#include <deque>
+#include <event-sauce/misc/mpsc-inbox.hpp>
+#include <atomic>
+#include <cstdint>
+#include <functional>
 #include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
+// Outbound message, owned by the queue between publish() and the I/O thread
+struct outbound_message : event_sauce::inbox_node
+{
+  explicit outbound_message(zmq::message_t&& message)
+      : message{ std::move(message) }
+  {}
+
+  zmq::message_t message;
+};
+
+// Client :: connection to a Router
+//
+// The I/O thread blocks in zmq::poll on the DEALER socket and on an eventfd. publish() may be called from any thread:
+// it pushes the encoded message onto a lock-free queue and only writes to the eventfd if the I/O thread has not been
+// woken up already, and the I/O thread sends everything that is queued whenever it wakes up.
+//
+// In batching mode broadcasts are held back until flush() and then sent as one message, e.g. at the end of every
+// engine drain, see engine::on_drained. An event with a coalescing key drops the earlier event with the same key and
+// is appended like any other, so it stays behind the events that were published in between.
 template<typename Message>
 struct Client
 {
@@ -11,61 +43,126 @@ public:
 
   using callback_type = std::function<void(typename event_type::identity_type, typename event_type::message_type)>;
 
+  using batch_callback_type =
+    std::function<void(typename event_type::identity_type, std::vector<typename event_type::message_type>)>;
+
 private:
   zmq::context_t zmq;
   zmq::socket_t broker;
-  std::deque<std::function<void()>> event_queue;
+  event_sauce::mpsc_inbox outbox;
+  int wakeup;
+  std::atomic<bool> woken{ false };
+  std::atomic<bool> stopping{ false };
   std::future<void> event_loop_instance;
-  std::mutex key;
 
-  static void dispatch(callback_type& cb, const typename event_type::recv_type& msg) { cb(msg.from, msg.message); }
+  std::mutex pending_key;
+  bool batching = false;
+  // Coalesced events leave an empty place behind until the pending events are taken
+  std::vector<std::optional<typename event_type::message_type>> pending;
+  std::unordered_map<coalescing_slot, std::size_t, coalescing_slot_hash> pending_slots;
+  std::size_t coalesced = 0;
 
-  static typename event_type::recv_type decode(const std::string& str)
+  static std::optional<typename event_type::deliver_type> decode(const zmq::message_t& msg)
   {
-    typename event_type::recv_type evt;
-    std::istringstream ss{ str };
-    boost::archive::binary_iarchive ia{ ss };
-    ia >> evt;
-    return std::move(evt);
+    return decode_message<typename event_type::deliver_type>(msg);
   }
 
-  static std::string encode(const typename event_type::send_type& evt)
+  static zmq::message_t encode(const typename event_type::send_type& evt) { return encode_message(evt); }
+
+  void enqueue(zmq::message_t&& msg)
   {
-    std::ostringstream ss;
-    boost::archive::binary_oarchive oa{ ss };
-    oa << evt;
-    return ss.str();
+    outbox.push(*new outbound_message{ std::move(msg) });
+    wake();
   }
 
-  void notify_presence()
+  void wake()
   {
-    auto msg = encode(typename event_type::notify_presence{});
-    std::lock_guard<std::mutex> guard{ key };
-    event_queue.push_back([msg = std::move(msg), this] {
-      send_more(this->broker, "");
-      send_one(this->broker, std::move(msg));
+    if (!woken.exchange(true, std::memory_order_acq_rel)) {
+      const auto one = std::uint64_t{ 1 };
+      [[maybe_unused]] const auto written = ::write(wakeup, &one, sizeof(one));
+    }
+  }
+
+  void notify_presence() { enqueue(encode(typename event_type::notify_presence{})); }
+
+  // Next queued message; a push that is still being linked is waited for
+  std::unique_ptr<outbound_message> dequeue()
+  {
+    while (!outbox.empty()) {
+      if (auto* node = outbox.pop()) {
+        return std::unique_ptr<outbound_message>{ static_cast<outbound_message*>(node) };
+      }
+      std::this_thread::yield();
+    }
+    return nullptr;
+  }
+
+  // Takes everything that is pending, with the lock held
+  std::vector<typename event_type::message_type> take_pending()
+  {
+    auto messages = std::vector<typename event_type::message_type>{};
+    messages.reserve(pending.size() - coalesced);
+    for (auto& message : pending) {
+      if (message) {
+        messages.push_back(std::move(*message));
+      }
+    }
+    pending.clear();
+    pending_slots.clear();
+    coalesced = 0;
+    return messages;
+  }
+
+  void send_batch(std::vector<typename event_type::message_type>&& messages)
+  {
+    if (messages.size() == 1) {
+      enqueue(encode(typename event_type::broadcast_type{ std::move(messages.front()) }));
+    } else if (!messages.empty()) {
+      enqueue(encode(typename event_type::batch_type{ std::move(messages) }));
+    }
+  }
+
+  template<typename Deliver>
+  void start_loop(Deliver deliver)
+  {
+    event_loop_instance = std::async(std::launch::async, [this, deliver = std::move(deliver)]() mutable {
+      event_loop(std::move(deliver));
     });
+    notify_presence();
   }
 
-  void event_loop(callback_type cb)
+  // Deliver is called with each decoded recv_type or recv_batch_type
+  template<typename Deliver>
+  void event_loop(Deliver deliver)
   {
-    while (true) {
+    zmq::pollitem_t items[] = { { static_cast<void*>(broker), 0, ZMQ_POLLIN, 0 }, { nullptr, wakeup, ZMQ_POLLIN, 0 } };
+    while (!stopping.load(std::memory_order_acquire)) {
+      zmq::poll(items, 2, -1);
+
       // Recv
-      while (const auto msg = recv_one_noblock(broker, max_body_parts_size)) {
-        if (msg->size() > 0) {
-          auto m = Client::decode(*msg);
-          cb(m.from, m.message);
+      if (items[0].revents & ZMQ_POLLIN) {
+        while (const auto msg = recv_message_noblock(broker)) {
+          if (msg->size() > 0) {
+            if (auto m = Client::decode(*msg)) {
+              std::visit(deliver, std::move(*m));
+            } else {
+              std::cerr << "Client dropped a malformed message" << std::endl;
+            }
+          }
         }
       }
 
       // Send
-      std::lock_guard<std::mutex> guard{ key };
-      while (!event_queue.empty()) {
-        event_queue.front()();
-        event_queue.pop_front();
+      if (items[1].revents & ZMQ_POLLIN) {
+        auto count = std::uint64_t{ 0 };
+        [[maybe_unused]] const auto read = ::read(wakeup, &count, sizeof(count));
+        // Acquiring the flag makes the messages pushed before it was set visible, later ones wake us up again
+        woken.exchange(false, std::memory_order_acq_rel);
+      }
+      while (auto node = dequeue()) {
+        send_more(broker, "");
+        send_one(broker, std::move(node->message));
       }
-
-      std::this_thread::sleep_for(std::chrono::milliseconds{1});
     }
   }
 
@@ -73,6 +170,7 @@ public:
   Client(const std::string& endpoint)
       : zmq{ 1 }
       , broker{ zmq, ZMQ_DEALER }
+      , wakeup{ ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC) }
   {
     broker.connect(endpoint);
   }
@@ -83,29 +181,101 @@ public:
     start(std::forward<callback_type>(callback));
   }
 
+  Client(const Client&) = delete;
+  Client& operator=(const Client&) = delete;
+
+  ~Client()
+  {
+    if (event_loop_instance.valid()) {
+      stopping.store(true, std::memory_order_release);
+      woken.store(false, std::memory_order_release);
+      wake();
+      event_loop_instance.get();
+    }
+    while (dequeue()) {
+    }
+    ::close(wakeup);
+  }
+
+  // The callback is called once for every message, also for those that arrive in a batch
   void start(callback_type&& cb)
   {
-    event_loop_instance = std::async(std::launch::async, &Client::event_loop, this, std::forward<callback_type>(cb));
-    notify_presence();
+    start_loop([cb = std::move(cb)](auto&& received) mutable {
+      if constexpr (std::is_same_v<std::decay_t<decltype(received)>, typename event_type::recv_type>) {
+        cb(std::move(received.from), std::move(received.message));
+      } else {
+        for (auto& message : received.messages) {
+          cb(received.from, std::move(message));
+        }
+      }
+    });
   }
 
-  void publish(const typename event_type::message_type& message)
+  // The callback is called once for every batch, with a batch of one for a message that was not batched
+  void start_batched(batch_callback_type&& cb)
   {
-    auto msg = encode(typename event_type::broadcast_type{ message });
-    std::lock_guard<std::mutex> guard{ key };
-    event_queue.push_back([msg = std::move(msg), this] {
-      send_more(this->broker, "");
-      send_one(this->broker, std::move(msg));
+    start_loop([cb = std::move(cb)](auto&& received) mutable {
+      if constexpr (std::is_same_v<std::decay_t<decltype(received)>, typename event_type::recv_type>) {
+        auto messages = std::vector<typename event_type::message_type>{};
+        messages.push_back(std::move(received.message));
+        cb(std::move(received.from), std::move(messages));
+      } else {
+        cb(std::move(received.from), std::move(received.messages));
+      }
     });
   }
 
+  // Holds broadcasts back until flush() while enabled; disabling flushes
+  void set_batching(bool enabled)
+  {
+    auto messages = std::vector<typename event_type::message_type>{};
+    {
+      std::lock_guard<std::mutex> guard{ pending_key };
+      batching = enabled;
+      messages = take_pending();
+    }
+    send_batch(std::move(messages));
+  }
+
+  // Sends the broadcasts held back since the last flush as one message
+  void flush()
+  {
+    auto messages = std::vector<typename event_type::message_type>{};
+    {
+      std::lock_guard<std::mutex> guard{ pending_key };
+      messages = take_pending();
+    }
+    send_batch(std::move(messages));
+  }
+
+  // Only broadcasts of these alternatives of the message variant are received from now on, see subscription_to and
+  // subscription_for
+  void subscribe(subscription_type alternatives) { enqueue(encode(typename event_type::subscribe{ alternatives })); }
+
+  void publish(const typename event_type::message_type& message)
+  {
+    {
+      std::lock_guard<std::mutex> guard{ pending_key };
+      if (batching) {
+        if (const auto slot = coalescing_slot_of(message)) {
+          const auto [it, inserted] = pending_slots.try_emplace(*slot, pending.size());
+          if (!inserted) {
+            pending[it->second].reset();
+            it->second = pending.size();
+            ++coalesced;
+          }
+        }
+        pending.push_back(message);
+        return;
+      }
+    }
+    enqueue(encode(typename event_type::broadcast_type{ message }));
+  }
+
+  // Targetted messages are never batched, the broadcasts held back are sent first to keep the order
   void publish(const typename event_type::message_type& message, const typename event_type::identity_type& identity)
   {
-    auto msg = encode(typename event_type::targetted_type{ identity, message });
-    std::lock_guard<std::mutex> guard{ key };
-    event_queue.push_back([msg = std::move(msg), this] {
-      send_more(this->broker, "");
-      send_one(this->broker, std::move(msg));
-    });
+    flush();
+    enqueue(encode(typename event_type::targetted_type{ identity, message }));
   }
 };
@@ -1,10 +1,14 @@
 #pragma once
-#include "../vendor/serialize_std_variant.hpp"
-#include <boost/archive/binary_iarchive.hpp>
-#include <boost/archive/binary_oarchive.hpp>
+#include "wire.hpp"
+#include <event-sauce/event-sauce.hpp>
+#include <cstdint>
+#include <functional>
 #include <iostream>
 #include <optional>
-#include <sstream>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
 #include <zmq.hpp>
 
 static constexpr auto max_identity_size = 10;
@@ -26,6 +30,53 @@ send_one(zmq::socket_t& broker, const std::string& message)
   broker.send(msg);
 };
 
+void
+send_more(zmq::socket_t& broker, zmq::message_t&& message)
+{
+  broker.send(message, ZMQ_SNDMORE);
+};
+
+void
+send_one(zmq::socket_t& broker, zmq::message_t&& message)
+{
+  broker.send(message);
+};
+
+// A message holding the encoded value, written in place without an intermediate buffer
+template<typename T>
+zmq::message_t
+encode_message(const T& value)
+{
+  zmq::message_t msg{ wire::encoded_size(value) };
+  wire::encode(value, msg.data());
+  return msg;
+}
+
+template<typename T>
+std::optional<T>
+decode_message(const zmq::message_t& msg)
+{
+  return wire::decode<T>(msg.data(), msg.size());
+}
+
+auto
+recv_message(zmq::socket_t& broker) -> zmq::message_t
+{
+  zmq::message_t msg;
+  broker.recv(&msg);
+  return msg;
+}
+
+auto
+recv_message_noblock(zmq::socket_t& broker) -> std::optional<zmq::message_t>
+{
+  zmq::message_t msg;
+  if (broker.recv(&msg, ZMQ_NOBLOCK)) {
+    return { std::move(msg) };
+  }
+  return {};
+}
+
 auto
 recv_one(zmq::socket_t& broker, std::size_t max_msg_size) -> std::string
 {
@@ -46,6 +97,159 @@ recv_one_noblock(zmq::socket_t& broker, std::size_t max_msg_size) -> std::option
   return {};
 }
 
+// A shared copy of the message, zmq_msg_copy shares the payload instead of copying it
+inline zmq::message_t
+share(zmq::message_t& message)
+{
+  zmq::message_t shared;
+  shared.copy(&message);
+  return shared;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Subscriptions
+////////////////////////////////////////////////////////////////////////////////
+
+// One bit per alternative of the message variant; a message that is not a variant is alternative 0
+using subscription_type = std::uint64_t;
+
+static constexpr auto all_alternatives = ~subscription_type{ 0 };
+
+namespace detail {
+
+template<typename T>
+struct type_tag
+{
+  using type = T;
+};
+
+template<typename T, typename Variant>
+struct alternative_index;
+
+template<typename T, typename... Ts>
+struct alternative_index<T, std::variant<Ts...>>
+{
+  static_assert((std::is_same_v<T, Ts> || ...), "not an alternative of the message variant");
+
+  static constexpr std::size_t value()
+  {
+    constexpr bool matches[] = { std::is_same_v<T, Ts>... };
+    auto index = std::size_t{ 0 };
+    while (!matches[index]) {
+      ++index;
+    }
+    return index;
+  }
+};
+
+template<typename Message, typename Predicate, std::size_t... Is>
+constexpr subscription_type
+subscription_where(Predicate predicate, std::index_sequence<Is...>)
+{
+  return (subscription_type{ 0 } | ... |
+          (predicate(type_tag<std::variant_alternative_t<Is, Message>>{}) ? subscription_type{ 1 } << Is : 0));
+}
+
+} // namespace detail
+
+template<typename Message>
+std::size_t
+alternative_of(const Message& message)
+{
+  if constexpr (wire::detail::is_variant<Message>::value) {
+    static_assert(std::variant_size_v<Message> <= 64, "a subscription has one bit per alternative");
+    return message.index();
+  } else {
+    return 0;
+  }
+}
+
+// Subscription to the given alternatives of the message variant
+template<typename Message, typename... Events>
+constexpr subscription_type
+subscription_to()
+{
+  return (subscription_type{ 0 } | ... |
+          (subscription_type{ 1 } << detail::alternative_index<Events, Message>::value()));
+}
+
+// Subscription to the alternatives of the message variant that any of the aggregates applies
+template<typename Message, typename... Aggregates>
+constexpr subscription_type
+subscription_for()
+{
+  const auto applied = [](auto tag) {
+    using event_type = const typename decltype(tag)::type&;
+    return (... || (event_sauce::detail::can_apply<Aggregates, event_type> ||
+                    event_sauce::detail::can_apply_in_place<Aggregates, event_type> ||
+                    event_sauce::detail::can_apply_transient<Aggregates, event_type>));
+  };
+  return detail::subscription_where<Message>(applied, std::make_index_sequence<std::variant_size_v<Message>>{});
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Coalescing
+//
+// An event type for which a free function 'coalescing_key(const Event&)' returning an integral key is found by
+// argument dependent lookup is a state update: in a batch, a later event of the type with the same key replaces the
+// earlier one, see Client::set_batching.
+////////////////////////////////////////////////////////////////////////////////
+
+// Alternative and key of a coalescing message
+using coalescing_slot = std::pair<std::size_t, std::uint64_t>;
+
+struct coalescing_slot_hash
+{
+  std::size_t operator()(const coalescing_slot& slot) const
+  {
+    return std::hash<std::uint64_t>{}(slot.second * 0x9e3779b97f4a7c15ull + slot.first);
+  }
+};
+
+namespace detail {
+
+template<typename Event, typename = void>
+struct has_coalescing_key : std::false_type
+{};
+
+template<typename Event>
+struct has_coalescing_key<Event, std::void_t<decltype(coalescing_key(std::declval<const Event&>()))>>
+    : std::true_type
+{};
+
+template<typename Event>
+std::optional<std::uint64_t>
+coalescing_key_of(const Event& evt)
+{
+  if constexpr (has_coalescing_key<Event>::value) {
+    return static_cast<std::uint64_t>(coalescing_key(evt));
+  } else {
+    return std::nullopt;
+  }
+}
+
+} // namespace detail
+
+template<typename Message>
+std::optional<coalescing_slot>
+coalescing_slot_of(const Message& message)
+{
+  auto key = std::optional<std::uint64_t>{};
+  if constexpr (wire::detail::is_variant<Message>::value) {
+    key = std::visit([](const auto& evt) { return detail::coalescing_key_of(evt); }, message);
+  } else {
+    key = detail::coalescing_key_of(message);
+  }
+  if (!key) {
+    return std::nullopt;
+  }
+  return coalescing_slot{ alternative_of(message), *key };
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Messages between clients and routers
+////////////////////////////////////////////////////////////////////////////////
+
 template<typename Message>
 struct event
 {
@@ -75,7 +279,32 @@ struct event
     {}
   };
 
-  using send_type = std::variant<broadcast_type, targetted_type, notify_presence>;
+  // Broadcasts of the alternatives that are not in the subscription are not sent to the client, which is subscribed to
+  // all of them until it says otherwise
+  struct subscribe
+  {
+    subscription_type alternatives = all_alternatives;
+
+    template<typename Archive>
+    void serialize(Archive& ar, const unsigned int version)
+    {
+      ar & this->alternatives;
+    }
+  };
+
+  // Broadcasts collected by a batching client, in the order they were published
+  struct batch_type
+  {
+    std::vector<message_type> messages;
+
+    template<typename Archive>
+    void serialize(Archive& ar, const unsigned int version)
+    {
+      ar & this->messages;
+    }
+  };
+
+  using send_type = std::variant<broadcast_type, targetted_type, notify_presence, subscribe, batch_type>;
 
   struct recv_type
   {
@@ -89,4 +318,20 @@ struct event
       ar & this->message;
     }
   };
+
+  // The messages of a batch that the receiving client is subscribed to
+  struct recv_batch_type
+  {
+    identity_type from;
+    std::vector<message_type> messages;
+
+    template<typename Archive>
+    void serialize(Archive& ar, const unsigned int version)
+    {
+      ar & this->from;
+      ar & this->messages;
+    }
+  };
+
+  using deliver_type = std::variant<recv_type, recv_batch_type>;
 };
@@ -1,6 +1,15 @@
 #pragma once
 #include "common.hpp"
-#include <immer/set.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 template<typename Message>
 struct Router
@@ -8,21 +17,220 @@ struct Router
 
   using event_type = event<Message>;
 
-  static std::string encode(const typename event_type::recv_type& evt)
+  static zmq::message_t encode(const typename event_type::deliver_type& evt) { return encode_message(evt); }
+
+  static std::optional<typename event_type::send_type> decode(const zmq::message_t& msg)
+  {
+    return decode_message<typename event_type::send_type>(msg);
+  }
+
+  // Clients are only ever added, so a broadcast iterates the table as it is instead of building the set of others
+  using client_table = std::unordered_map<std::string, subscription_type>;
+
+  static subscription_type alternatives_of(const typename event_type::message_type& message)
+  {
+    return subscription_type{ 1 } << alternative_of(message);
+  }
+
+  static subscription_type alternatives_of(const std::vector<typename event_type::message_type>& messages)
+  {
+    auto alternatives = subscription_type{ 0 };
+    for (const auto& message : messages) {
+      alternatives |= alternatives_of(message);
+    }
+    return alternatives;
+  }
+
+  // The messages of the delivery, which is a batch, that are of the given alternatives
+  static typename event_type::deliver_type filtered(const typename event_type::deliver_type& delivery,
+                                                    subscription_type alternatives)
+  {
+    auto result = typename event_type::recv_batch_type{};
+    if (const auto* batch = std::get_if<typename event_type::recv_batch_type>(&delivery)) {
+      result.from = batch->from;
+      std::copy_if(batch->messages.begin(),
+                   batch->messages.end(),
+                   std::back_inserter(result.messages),
+                   [alternatives](const auto& message) { return (alternatives_of(message) & alternatives) != 0; });
+    }
+    return result;
+  }
+
+  // Hands the encoded delivery, holding messages of the given alternatives, to send once for every distinct payload,
+  // together with the clients but the source that are subscribed to any of them. Those subscribed to all of them share
+  // the payload, the others get the part of a batch they are subscribed to, encoded once for each distinct part.
+  template<typename Send>
+  static void fan_out(const client_table& clients,
+                      std::string_view source,
+                      subscription_type alternatives,
+                      zmq::message_t& payload,
+                      Send&& send)
+  {
+    auto groups = std::unordered_map<subscription_type, std::vector<std::string_view>>{};
+    for (const auto& [destination, subscription] : clients) {
+      const auto wanted = subscription & alternatives;
+      if (destination != source && wanted != 0) {
+        groups[wanted].push_back(destination);
+      }
+    }
+
+    auto delivery = std::optional<typename event_type::deliver_type>{};
+    for (const auto& [wanted, destinations] : groups) {
+      if (wanted == alternatives) {
+        send(destinations, payload);
+        continue;
+      }
+      if (!delivery) {
+        delivery = decode_message<typename event_type::deliver_type>(payload);
+        if (!delivery) {
+          return;
+        }
+      }
+      auto part = encode(filtered(*delivery, wanted));
+      send(destinations, part);
+    }
+  }
+
+  /*****************************************************************************
+   ** Sharding
+   **
+   ** The frontend thread owns the ROUTER socket and only moves frames around: it hands every incoming message to the
+   ** shard that owns the client, chosen by hashing its identity, and sends what the shards deliver. A shard decodes
+   ** the messages of its clients, keeps their subscriptions and encodes what they send. A broadcast is encoded once by
+   ** the shard of its source and then goes through the frontend to every shard, which works out which of its clients
+   ** are subscribed to it and hands the shared payload back in one deliver message listing all of them. A targetted
+   ** message takes the same way, through the frontend to the shard of its destination, so it can not overtake the
+   ** broadcasts its source sent before it: every pipe is FIFO and the shard of the destination delivers both in order.
+   **
+   ** Frontend and shards talk over inproc PAIR sockets in messages of a shard_header, a payload and one or more
+   ** identities: the source for inbound, broadcast and fanout, and the destinations for targetted, direct and deliver.
+   ** The pipes have no high-water mark, so neither side ever blocks on a send to the other while the other is blocked
+   ** on a send too.
+   *****************************************************************************/
+  enum class shard_kind : std::uint8_t
+  {
+    inbound,   // frontend -> shard, a message from a client of the shard
+    deliver,   // shard -> frontend, to be sent to every listed client
+    broadcast, // shard -> frontend, to be fanned out to every shard
+    fanout,    // frontend -> shard, a broadcast to deliver to the subscribed clients
+    targetted, // shard -> frontend, to be passed to the shard of the listed client
+    direct     // frontend -> shard, a targetted message to deliver to the listed client
+  };
+
+  struct shard_header
+  {
+    shard_kind kind;
+    subscription_type alternatives;
+  };
+
+  struct shard_message
   {
-    std::ostringstream ss;
-    boost::archive::binary_oarchive oa{ ss };
-    oa << evt;
-    return ss.str();
+    std::optional<shard_header> header;
+    zmq::message_t body;
+    std::vector<zmq::message_t> identities;
+  };
+
+  static zmq::message_t to_message(std::string_view str) { return { str.data(), str.size() }; }
+
+  static std::string_view to_string_view(const zmq::message_t& msg)
+  {
+    return { static_cast<const char*>(msg.data()), msg.size() };
   }
 
-  static typename event_type::send_type decode(const std::string& str)
+  static zmq::socket_t make_pipe(zmq::context_t& zmq)
   {
-    typename event_type::send_type evt;
-    std::istringstream ss{ str };
-    boost::archive::binary_iarchive ia{ ss };
-    ia >> evt;
-    return std::move(evt);
+    zmq::socket_t socket{ zmq, ZMQ_PAIR };
+    socket.setsockopt(ZMQ_SNDHWM, 0);
+    socket.setsockopt(ZMQ_RCVHWM, 0);
+    return socket;
+  }
+
+  template<typename Identities>
+  static void send_frames(zmq::socket_t& socket,
+                          shard_header header,
+                          zmq::message_t&& body,
+                          const Identities& identities)
+  {
+    send_more(socket, encode_message(header));
+    send_more(socket, std::move(body));
+    auto remaining = identities.size();
+    for (const auto& identity : identities) {
+      if (--remaining > 0) {
+        send_more(socket, to_message(identity));
+      } else {
+        send_one(socket, to_message(identity));
+      }
+    }
+  }
+
+  static void send_frames(zmq::socket_t& socket, shard_header header, zmq::message_t&& body, zmq::message_t&& identity)
+  {
+    send_more(socket, encode_message(header));
+    send_more(socket, std::move(body));
+    send_one(socket, std::move(identity));
+  }
+
+  static shard_message recv_frames(zmq::socket_t& socket, zmq::message_t&& header)
+  {
+    auto result = shard_message{};
+    result.header = decode_message<shard_header>(header);
+    result.body = recv_message(socket);
+    do {
+      result.identities.push_back(recv_message(socket));
+    } while (result.identities.back().more());
+    return result;
+  }
+
+  static void shard_loop(zmq::context_t& zmq, const std::string& address)
+  {
+    auto frontend = make_pipe(zmq);
+    frontend.connect(address);
+    client_table clients;
+
+    while (true) {
+      auto [header, body, identities] = recv_frames(frontend, recv_message(frontend));
+      if (!header) {
+        continue;
+      }
+      if (header->kind == shard_kind::direct) {
+        send_frames(frontend, { shard_kind::deliver, 0 }, std::move(body), std::move(identities.front()));
+        continue;
+      }
+
+      const auto source = to_string_view(identities.front());
+
+      if (header->kind == shard_kind::fanout) {
+        fan_out(clients, source, header->alternatives, body, [&frontend](const auto& destinations, auto& payload) {
+          send_frames(frontend, { shard_kind::deliver, 0 }, share(payload), destinations);
+        });
+        continue;
+      }
+
+      const auto received = decode(body);
+      if (!received) {
+        std::cerr << "Client " << source << " sent a malformed message" << std::endl;
+        continue;
+      }
+      const auto& evt = *received;
+      auto& subscription = clients.try_emplace(std::string{ source }, all_alternatives).first->second;
+
+      if (const auto* targetted_event = std::get_if<typename event_type::targetted_type>(&evt)) {
+        auto payload = encode(typename event_type::recv_type{ std::string{ source }, targetted_event->message });
+        send_frames(frontend, { shard_kind::targetted, 0 }, std::move(payload), to_message(targetted_event->other));
+      } else if (const auto* broadcast_event = std::get_if<typename event_type::broadcast_type>(&evt)) {
+        const auto header = shard_header{ shard_kind::broadcast, alternatives_of(*broadcast_event) };
+        auto payload = encode(typename event_type::recv_type{ std::string{ source }, *broadcast_event });
+        send_frames(frontend, header, std::move(payload), std::move(identities.front()));
+      } else if (const auto* batch_event = std::get_if<typename event_type::batch_type>(&evt)) {
+        const auto header = shard_header{ shard_kind::broadcast, alternatives_of(batch_event->messages) };
+        auto payload = encode(typename event_type::recv_batch_type{ std::string{ source }, batch_event->messages });
+        send_frames(frontend, header, std::move(payload), std::move(identities.front()));
+      } else if (const auto* subscribe_event = std::get_if<typename event_type::subscribe>(&evt)) {
+        subscription = subscribe_event->alternatives;
+      } else if (std::holds_alternative<typename event_type::notify_presence>(evt)) {
+        std::cerr << "Client " << source << " connected" << std::endl;
+      }
+    }
   }
 
 public:
@@ -41,7 +249,7 @@ public:
     auto recv = [&broker] {
       auto identity = recv_one(broker, max_identity_size);
       recv_one(broker, 0); // delimiter
-      auto body_parts = recv_one(broker, max_body_parts_size);
+      auto body_parts = recv_message(broker);
       auto evt = decode(body_parts);
       return std::make_tuple(std::move(identity), std::move(evt));
     };
@@ -49,37 +257,123 @@ public:
     /***************************************************************************
      ** send
      ***************************************************************************/
-    auto send = [&broker](const std::string& identity, const typename event_type::recv_type& evt) {
-      send_more(broker, identity);
+    // The payload is shared with the message that is sent, not copied, so it can be sent to every destination
+    auto send = [&broker](std::string_view identity, zmq::message_t& payload) {
+      send_more(broker, to_message(identity));
       send_more(broker, "");
-      send_one(broker, encode(evt));
+      send_one(broker, share(payload));
+    };
+    auto send_all = [&send](const auto& destinations, zmq::message_t& payload) {
+      for (const auto& destination : destinations) {
+        send(destination, payload);
+      }
     };
 
     /***************************************************************************
      ** loop
      ***************************************************************************/
-    immer::set<std::string> clients;
+    client_table clients;
 
     while (true) {
-      auto [source, evt] = recv();
-      clients = clients.insert(source);
-
-      const auto others = clients.erase(source);
-
-      if (std::holds_alternative<typename event_type::targetted_type>(evt)) {
-        auto targetted_event = std::get<typename event_type::targetted_type>(evt);
-        const auto destination = targetted_event.other;
-        const auto msg = typename event_type::recv_type{ source, targetted_event.message };
-        send(destination, msg);
-      } else if (std::holds_alternative<typename event_type::broadcast_type>(evt)) {
-        auto broadcast_event = std::get<typename event_type::broadcast_type>(evt);
-        std::for_each(others.begin(), others.end(), [&](const auto& destination) {
-          const auto msg = typename event_type::recv_type{ source, broadcast_event };
-          send(destination, msg);
-        });
+      auto [source, received] = recv();
+      if (!received) {
+        std::cerr << "Client " << source << " sent a malformed message" << std::endl;
+        continue;
+      }
+      const auto& evt = *received;
+      auto& subscription = clients.try_emplace(source, all_alternatives).first->second;
+
+      if (const auto* targetted_event = std::get_if<typename event_type::targetted_type>(&evt)) {
+        auto payload = encode(typename event_type::recv_type{ source, targetted_event->message });
+        send(targetted_event->other, payload);
+      } else if (const auto* broadcast_event = std::get_if<typename event_type::broadcast_type>(&evt)) {
+        auto payload = encode(typename event_type::recv_type{ source, *broadcast_event });
+        fan_out(clients, source, alternatives_of(*broadcast_event), payload, send_all);
+      } else if (const auto* batch_event = std::get_if<typename event_type::batch_type>(&evt)) {
+        auto payload = encode(typename event_type::recv_batch_type{ source, batch_event->messages });
+        fan_out(clients, source, alternatives_of(batch_event->messages), payload, send_all);
+      } else if (const auto* subscribe_event = std::get_if<typename event_type::subscribe>(&evt)) {
+        subscription = subscribe_event->alternatives;
       } else if (std::holds_alternative<typename event_type::notify_presence>(evt)) {
         std::cerr << "Client " << source << " connected" << std::endl;
       }
     }
   }
+
+  // Like event_loop, with the clients spread over the given number of shards that run on threads of their own
+  static auto sharded_event_loop(const std::string& endpoint, std::size_t shard_count)
+  {
+    /***************************************************************************
+     ** setup
+     ***************************************************************************/
+    shard_count = std::max<std::size_t>(shard_count, 1);
+    zmq::context_t zmq{ 1 };
+    zmq::socket_t broker{ zmq, ZMQ_ROUTER };
+    broker.bind(endpoint);
+
+    // Inproc endpoints must be bound before they are connected to
+    std::vector<zmq::socket_t> shards;
+    std::vector<std::thread> threads;
+    shards.reserve(shard_count);
+    for (auto i = std::size_t{ 0 }; i < shard_count; ++i) {
+      const auto address = "inproc://shard-" + std::to_string(i);
+      shards.push_back(make_pipe(zmq));
+      shards.back().bind(address);
+      threads.emplace_back([&zmq, address] { shard_loop(zmq, address); });
+    }
+
+    /***************************************************************************
+     ** loop
+     ***************************************************************************/
+    auto shard_of = [&shards, shard_count](const zmq::message_t& identity) -> zmq::socket_t& {
+      return shards[std::hash<std::string_view>{}(to_string_view(identity)) % shard_count];
+    };
+
+    auto items = std::vector<zmq::pollitem_t>{ { static_cast<void*>(broker), 0, ZMQ_POLLIN, 0 } };
+    for (auto& shard : shards) {
+      items.push_back({ static_cast<void*>(shard), 0, ZMQ_POLLIN, 0 });
+    }
+
+    while (true) {
+      zmq::poll(items.data(), items.size(), -1);
+
+      // From the clients to the shard that owns them
+      if (items[0].revents & ZMQ_POLLIN) {
+        while (auto identity = recv_message_noblock(broker)) {
+          recv_message(broker); // delimiter
+          auto body = recv_message(broker);
+          send_frames(shard_of(*identity), { shard_kind::inbound, 0 }, std::move(body), std::move(*identity));
+        }
+      }
+
+      // From the shards to the clients, to every shard, or to the shard of a client
+      for (auto i = std::size_t{ 0 }; i < shard_count; ++i) {
+        if (!(items[i + 1].revents & ZMQ_POLLIN)) {
+          continue;
+        }
+        while (auto header_frame = recv_message_noblock(shards[i])) {
+          auto [header, body, identities] = recv_frames(shards[i], std::move(*header_frame));
+          if (!header) {
+            continue;
+          }
+          if (header->kind == shard_kind::broadcast) {
+            for (auto& shard : shards) {
+              send_frames(shard, { shard_kind::fanout, header->alternatives }, share(body), share(identities.front()));
+            }
+            continue;
+          }
+          if (header->kind == shard_kind::targetted) {
+            auto& shard = shard_of(identities.front());
+            send_frames(shard, { shard_kind::direct, 0 }, std::move(body), std::move(identities.front()));
+            continue;
+          }
+          for (auto& identity : identities) {
+            send_more(broker, std::move(identity));
+            send_more(broker, "");
+            send_one(broker, share(body));
+          }
+        }
+      }
+    }
+  }
 };
@@ -0,0 +1,394 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+// Binary wire codec
+//
+// Messages are described by the same hooks as boost::serialization, i.e. a member
+//
+//   template<typename Archive> void serialize(Archive& ar, const unsigned int version) { ar & this->field; }
+//
+// or a free serialize(Archive&, T&, const unsigned int) found by argument dependent lookup. The hooks are instantiated
+// for three archives: one that measures the encoded size, one that writes into a caller-owned buffer and one that reads
+// from it, so encoding is a size pass followed by a single write into the final buffer and decoding reads straight out
+// of the received bytes. There is no header, no versioning and no type registry: both ends must be built from the same
+// message types, with the same byte order.
+//
+// Arithmetic and enum fields, and trivially copyable types without a hook, are copied as they are. Strings and
+// vectors are prefixed with their 32 bit size, optionals with a byte telling whether they are engaged and variants with
+// the byte sized index of the alternative, which is decoded through a table generated from the alternatives.
+namespace wire {
+
+namespace detail {
+
+template<typename T>
+struct is_vector : std::false_type
+{};
+
+template<typename T, typename Allocator>
+struct is_vector<std::vector<T, Allocator>> : std::true_type
+{};
+
+template<typename T>
+struct is_variant : std::false_type
+{};
+
+template<typename... Ts>
+struct is_variant<std::variant<Ts...>> : std::true_type
+{};
+
+template<typename T>
+struct is_optional : std::false_type
+{};
+
+template<typename T>
+struct is_optional<std::optional<T>> : std::true_type
+{};
+
+template<typename T>
+struct is_pair : std::false_type
+{};
+
+template<typename A, typename B>
+struct is_pair<std::pair<A, B>> : std::true_type
+{};
+
+template<typename T>
+struct is_tuple : std::false_type
+{};
+
+template<typename... Ts>
+struct is_tuple<std::tuple<Ts...>> : std::true_type
+{};
+
+template<typename Archive, typename T, typename = void>
+struct has_member_serialize : std::false_type
+{};
+
+template<typename Archive, typename T>
+struct has_member_serialize<Archive,
+                            T,
+                            std::void_t<decltype(std::declval<T&>().serialize(std::declval<Archive&>(), 0u))>>
+    : std::true_type
+{};
+
+template<typename Archive, typename T, typename = void>
+struct has_free_serialize : std::false_type
+{};
+
+template<typename Archive, typename T>
+struct has_free_serialize<Archive,
+                          T,
+                          std::void_t<decltype(serialize(std::declval<Archive&>(), std::declval<T&>(), 0u))>>
+    : std::true_type
+{};
+
+template<typename T>
+constexpr bool is_raw = std::is_arithmetic_v<T> || std::is_enum_v<T>;
+
+// Vectors of these are copied in one go, except std::vector<bool> which has no data()
+template<typename T>
+constexpr bool is_bulk = is_raw<T> && !std::is_same_v<T, bool>;
+
+template<typename Archive, typename T>
+constexpr bool has_serialize = has_member_serialize<Archive, T>::value || has_free_serialize<Archive, T>::value;
+
+template<typename Archive, typename T>
+void
+fields(Archive& ar, T& value)
+{
+  if constexpr (has_member_serialize<Archive, T>::value) {
+    value.serialize(ar, 0u);
+  } else {
+    serialize(ar, value, 0u);
+  }
+}
+
+// Decoders of the alternatives of a variant, indexed by the alternative
+template<typename Reader, typename Variant, std::size_t... Is>
+constexpr auto
+make_emplacers(std::index_sequence<Is...>)
+{
+  using emplacer = void (*)(Reader&, Variant&);
+  return std::array<emplacer, sizeof...(Is)>{ +[](Reader& ar, Variant& value) {
+    ar& value.template emplace<Is>();
+  }... };
+}
+
+} // namespace detail
+
+////////////////////////////////////////////////////////////////////////////////
+// sizer :: counts the bytes a value encodes to
+////////////////////////////////////////////////////////////////////////////////
+
+class sizer
+{
+public:
+  template<typename T>
+  sizer& operator&(const T& value)
+  {
+    if constexpr (detail::is_raw<T>) {
+      bytes += sizeof(T);
+    } else if constexpr (std::is_same_v<T, std::string>) {
+      bytes += sizeof(std::uint32_t) + value.size();
+    } else if constexpr (detail::is_vector<T>::value) {
+      bytes += sizeof(std::uint32_t);
+      if constexpr (detail::is_bulk<typename T::value_type>) {
+        bytes += value.size() * sizeof(typename T::value_type);
+      } else {
+        for (const auto& element : value) {
+          *this & element;
+        }
+      }
+    } else if constexpr (detail::is_optional<T>::value) {
+      bytes += 1;
+      if (value) {
+        *this & *value;
+      }
+    } else if constexpr (detail::is_variant<T>::value) {
+      bytes += 1;
+      std::visit([this](const auto& alternative) { *this & alternative; }, value);
+    } else if constexpr (detail::is_pair<T>::value) {
+      *this & value.first & value.second;
+    } else if constexpr (detail::is_tuple<T>::value) {
+      std::apply([this](const auto&... elements) { (*this & ... & elements); }, value);
+    } else if constexpr (detail::has_serialize<sizer, T>) {
+      detail::fields(*this, const_cast<T&>(value));
+    } else {
+      static_assert(std::is_trivially_copyable_v<T>, "wire: no serialize hook for this type");
+      bytes += sizeof(T);
+    }
+    return *this;
+  }
+
+  std::size_t size() const { return bytes; }
+
+private:
+  std::size_t bytes = 0;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// writer :: encodes into a buffer that is large enough, see sizer
+////////////////////////////////////////////////////////////////////////////////
+
+class writer
+{
+public:
+  explicit writer(void* buffer)
+      : out{ static_cast<char*>(buffer) }
+  {}
+
+  template<typename T>
+  writer& operator&(const T& value)
+  {
+    if constexpr (detail::is_raw<T>) {
+      raw(&value, sizeof(T));
+    } else if constexpr (std::is_same_v<T, std::string>) {
+      length(value.size());
+      raw(value.data(), value.size());
+    } else if constexpr (detail::is_vector<T>::value) {
+      length(value.size());
+      if constexpr (detail::is_bulk<typename T::value_type>) {
+        raw(value.data(), value.size() * sizeof(typename T::value_type));
+      } else {
+        for (const auto& element : value) {
+          *this & element;
+        }
+      }
+    } else if constexpr (detail::is_optional<T>::value) {
+      *this & static_cast<std::uint8_t>(value.has_value());
+      if (value) {
+        *this & *value;
+      }
+    } else if constexpr (detail::is_variant<T>::value) {
+      static_assert(std::variant_size_v<T> <= 256, "wire: the variant index must fit in a byte");
+      *this & static_cast<std::uint8_t>(value.index());
+      std::visit([this](const auto& alternative) { *this & alternative; }, value);
+    } else if constexpr (detail::is_pair<T>::value) {
+      *this & value.first & value.second;
+    } else if constexpr (detail::is_tuple<T>::value) {
+      std::apply([this](const auto&... elements) { (*this & ... & elements); }, value);
+    } else if constexpr (detail::has_serialize<writer, T>) {
+      detail::fields(*this, const_cast<T&>(value));
+    } else {
+      static_assert(std::is_trivially_copyable_v<T>, "wire: no serialize hook for this type");
+      raw(&value, sizeof(T));
+    }
+    return *this;
+  }
+
+private:
+  void length(std::size_t size) { *this & static_cast<std::uint32_t>(size); }
+
+  void raw(const void* data, std::size_t size)
+  {
+    std::memcpy(out, data, size);
+    out += size;
+  }
+
+  char* out;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// reader :: decodes from a buffer, failing instead of reading past its end
+////////////////////////////////////////////////////////////////////////////////
+
+class reader
+{
+public:
+  reader(const void* buffer, std::size_t size)
+      : in{ static_cast<const char*>(buffer) }
+      , end{ in + size }
+  {}
+
+  template<typename T>
+  reader& operator&(T& value)
+  {
+    if (failed) {
+      return *this;
+    }
+    if constexpr (std::is_same_v<T, bool>) {
+      // Any other byte would make an invalid bool
+      auto byte = std::uint8_t{ 0 };
+      raw(&byte, sizeof(byte));
+      failed = failed || byte > 1;
+      value = byte == 1;
+    } else if constexpr (detail::is_raw<T>) {
+      raw(&value, sizeof(T));
+    } else if constexpr (std::is_same_v<T, std::string>) {
+      const auto size = length();
+      if (const auto* data = take(size)) {
+        value.assign(data, size);
+      }
+    } else if constexpr (detail::is_vector<T>::value) {
+      const auto size = length();
+      if constexpr (detail::is_bulk<typename T::value_type>) {
+        if (const auto* data = take(size * sizeof(typename T::value_type))) {
+          value.resize(size);
+          std::memcpy(value.data(), data, size * sizeof(typename T::value_type));
+        }
+      } else {
+        value.clear();
+        // Every element takes at least a byte, so a corrupt size can not make this reserve huge amounts of memory
+        value.reserve(std::min<std::size_t>(size, end - in));
+        for (auto i = std::size_t{ 0 }; i < size && !failed; ++i) {
+          if constexpr (std::is_same_v<typename T::value_type, bool>) {
+            auto element = false;
+            *this & element;
+            value.push_back(element);
+          } else {
+            *this & value.emplace_back();
+          }
+        }
+      }
+    } else if constexpr (detail::is_optional<T>::value) {
+      auto engaged = std::uint8_t{ 0 };
+      *this & engaged;
+      if (engaged) {
+        *this & value.emplace();
+      } else {
+        value.reset();
+      }
+    } else if constexpr (detail::is_variant<T>::value) {
+      static constexpr auto emplacers =
+        detail::make_emplacers<reader, T>(std::make_index_sequence<std::variant_size_v<T>>{});
+      auto index = std::uint8_t{ 0 };
+      *this & index;
+      if (index >= emplacers.size()) {
+        failed = true;
+      } else if (!failed) {
+        emplacers[index](*this, value);
+      }
+    } else if constexpr (detail::is_pair<T>::value) {
+      *this & value.first & value.second;
+    } else if constexpr (detail::is_tuple<T>::value) {
+      std::apply([this](auto&... elements) { (*this & ... & elements); }, value);
+    } else if constexpr (detail::has_serialize<reader, T>) {
+      detail::fields(*this, value);
+    } else {
+      static_assert(std::is_trivially_copyable_v<T>, "wire: no serialize hook for this type");
+      raw(&value, sizeof(T));
+    }
+    return *this;
+  }
+
+  // True if everything read so far was there, and nothing is left over
+  bool complete() const { return !failed && in == end; }
+
+private:
+  std::size_t length()
+  {
+    auto size = std::uint32_t{ 0 };
+    *this & size;
+    return size;
+  }
+
+  const char* take(std::size_t size)
+  {
+    if (failed || static_cast<std::size_t>(end - in) < size) {
+      failed = true;
+      return nullptr;
+    }
+    const auto* data = in;
+    in += size;
+    return data;
+  }
+
+  void raw(void* data, std::size_t size)
+  {
+    if (const auto* bytes = take(size)) {
+      std::memcpy(data, bytes, size);
+    }
+  }
+
+  const char* in;
+  const char* end;
+  bool failed = false;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Entry points
+////////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+std::size_t
+encoded_size(const T& value)
+{
+  auto ar = sizer{};
+  ar& value;
+  return ar.size();
+}
+
+// Writes exactly encoded_size(value) bytes to buffer
+template<typename T>
+void
+encode(const T& value, void* buffer)
+{
+  auto ar = writer{ buffer };
+  ar& value;
+}
+
+// The value, or nothing if the bytes are not exactly one encoded T
+template<typename T>
+std::optional<T>
+decode(const void* buffer, std::size_t size)
+{
+  auto value = T{};
+  auto ar = reader{ buffer, size };
+  ar& value;
+  if (!ar.complete()) {
+    return std::nullopt;
+  }
+  return value;
+}
+
+} // namespace wire
@@ -112,6 +112,14 @@ public:
   void operator()(const render_loop::rendering::started& evt)
   {}
 
+  void operator()(const render_loop::rendering::skipped& evt)
+  {
+    // Close the ImGui frame that input::collected opened, then sleep until the next physics step is due or input
+    // arrives, without vsync the loop would otherwise spin on input::collect
+    ImGui::EndFrame();
+    glfwWaitEventsTimeout(evt.idle.to<double>());
+  }
+
   void operator()(const render_loop::rendering::stopped& evt)
   {
     ImGui::Render();
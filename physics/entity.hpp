@@ -1,7 +1,7 @@
 #pragma once
+#include "../common/memory.hpp"
 #include <glm/gtc/quaternion.hpp>
 #include <glm/vec3.hpp>
-#include <immer/vector.hpp>
 #include <optional>
 
 namespace physics {
@@ -53,7 +53,7 @@ struct entity
     glm::quat orientation;
   };
 
-  using state_type = immer::vector<entity_type>;
+  using state_type = state_vector<entity_type>;
 
   //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
   // EXECUTE
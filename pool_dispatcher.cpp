@@ -14,6 +14,8 @@ pool_dispatcher::pool_dispatcher(int nthreads)
 
 pool_dispatcher::~pool_dispatcher()
 {
+  // A pending wait on the signal set would keep io_context::run() from returning
+  signal_set.cancel();
   work.reset();
   pool.join_all();
 }
@@ -25,7 +27,7 @@ pool_dispatcher::install_signal_handler(const std::vector<int>& signals, std::fu
   signal_set.async_wait([callback, &serializer = this->serializer](boost::system::error_code ec, int) {
     if (!ec) {
       boost::asio::post(serializer, std::move(callback));
-    } else {
+    } else if (ec != boost::asio::error::operation_aborted) {
       throw std::runtime_error{ ec.message() };
     }
   });
@@ -4,8 +4,12 @@
 #include <boost/asio/post.hpp>
 #include <boost/asio/signal_set.hpp>
 #include <boost/thread/thread.hpp>
+#include <event-sauce/scheduler/concurrency.hpp>
 #include <functional>
+#include <future>
+#include <memory>
 #include <thread>
+#include <type_traits>
 #include <vector>
 
 class pool_dispatcher
@@ -26,14 +30,19 @@ public:
     return io_context;
   }
 
-  auto serial()
+  auto operator()(event_sauce::concurrency::serialized_tag)
   {
     return [this](auto&& fn) { boost::asio::post(serializer, std::forward<decltype(fn)>(fn)); };
   }
 
-  auto concurrent()
+  auto operator()(event_sauce::concurrency::parallel_tag)
   {
-    return [this](auto&& fn) { boost::asio::post(io_context, std::forward<decltype(fn)>(fn)); };
+    return [this](auto&& fn) {
+      using result_type = std::invoke_result_t<decltype(fn)>;
+      auto task = std::make_shared<std::packaged_task<result_type()>>(std::forward<decltype(fn)>(fn));
+      boost::asio::post(io_context, [task] { (*task)(); });
+      return task->get_future();
+    };
   }
 
   void install_signal_handler(const std::vector<int>& signals, std::function<void()> callback);
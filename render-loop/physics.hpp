@@ -1,12 +1,27 @@
 #pragma once
+#include "../commands.hpp"
 #include "../common/units.hpp"
 #include "input.hpp"
+#include <algorithm>
 #include <chrono>
+#include <tuple>
+#include <vector>
 
 namespace render_loop {
 
+// physics :: fixed-timestep clock of the render loop
+//
+// Every frame adds the time since the previous one to an accumulator and takes as many Ticks of step_size() as fit in
+// it, so the simulation advances at step_rate no matter how fast frames are rendered. A frame that took longer than
+// max_steps_per_frame steps drops the excess instead of falling further behind. What is left in the accumulator is
+// handed on as alpha, the fraction of a step that has passed since the last one.
 struct physics
 {
+  static constexpr int step_rate = 120;
+  static constexpr int max_steps_per_frame = 8;
+
+  static second_t step_size() { return second_t{ 1.0 / step_rate }; }
+
   //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
   // COMMANDS
   //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -27,7 +42,10 @@ struct physics
   };
 
   struct stopped
-  {};
+  {
+    int steps;
+    double alpha;
+  };
 
   //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
   // STATE
@@ -37,6 +55,9 @@ struct physics
   {
     std::chrono::high_resolution_clock::time_point time;
     second_t delta_time = 0_s;
+    second_t accumulator = 0_s;
+    int steps = 0;
+    CorrelationId frame = 0;
   };
 
   //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -48,9 +69,9 @@ struct physics
     return started{ std::chrono::high_resolution_clock::now() };
   }
 
-  static stopped execute(const state_type&, const stop&)
+  static stopped execute(const state_type& state, const stop&)
   {
-    return stopped{};
+    return stopped{ state.steps, (state.accumulator / step_size()).to<double>() };
   }
 
   //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -59,7 +80,14 @@ struct physics
 
   static state_type apply(const state_type& state, const started& evt)
   {
-    return { evt.time, evt.time - state.time };
+    auto next = state;
+    next.time = evt.time;
+    next.delta_time = state.frame == 0 ? 0_s : second_t{ evt.time - state.time };
+    next.accumulator = std::min(state.accumulator + next.delta_time, max_steps_per_frame * step_size());
+    next.steps = static_cast<int>((next.accumulator / step_size()).to<double>());
+    next.accumulator -= next.steps * step_size();
+    ++next.frame;
+    return next;
   }
 
   //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -71,9 +99,9 @@ struct physics
     return start{};
   }
 
-  static stop process(const state_type&, const started&)
+  static std::tuple<std::vector<Tick>, stop> process(const state_type& state, const started&)
   {
-    return stop{};
+    return { std::vector<Tick>(state.steps, Tick{ state.frame, step_size() }), stop{} };
   }
 };
 
@@ -1,5 +1,6 @@
 #pragma once
 #include "physics.hpp"
+#include <variant>
 
 namespace render_loop {
 
@@ -15,6 +16,11 @@ struct rendering
   struct stop
   {};
 
+  struct skip
+  {
+    second_t idle;
+  };
+
   //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
   // EVENTS
   //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -25,6 +31,11 @@ struct rendering
   struct stopped
   {};
 
+  struct skipped
+  {
+    second_t idle;
+  };
+
   //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
   // STATE
   //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -46,6 +57,11 @@ struct rendering
     return stopped{};
   }
 
+  static skipped execute(const state_type& state, const skip& cmd)
+  {
+    return skipped{ cmd.idle };
+  }
+
   //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
   // APPLY
   //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -64,9 +80,14 @@ struct rendering
   // PROCESSES
   //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-  static start process(const state_type&, const physics::stopped&)
+  // A frame in which physics did not step would look like the previous one, so it is not drawn. Instead the frame
+  // idles for the rest of the step, which is what alpha says is left of it, rather than polling input until it is due.
+  static std::variant<start, skip> process(const state_type&, const physics::stopped& evt)
   {
-    return start{};
+    if (evt.steps > 0) {
+      return start{};
+    }
+    return skip{ (1.0 - evt.alpha) * physics::step_size() };
   }
 
   static stop process(const state_type&, const started&)
@@ -78,6 +99,11 @@ struct rendering
   {
     return input::collect{};
   }
+
+  static input::collect process(const state_type&, const skipped&)
+  {
+    return input::collect{};
+  }
 };
 
 }
@@ -1,5 +1,15 @@
 #pragma once
+#include <boost/fiber/algo/work_stealing.hpp>
 #include <boost/fiber/all.hpp>
+#include <event-sauce/scheduler/concurrency.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <type_traits>
 
 class fiber_scheduler
 {
@@ -12,44 +22,99 @@ public:
       , concurrent_channel{ concurrent_size }
   {}
 
-  auto serial()
+  auto operator()(event_sauce::concurrency::serialized_tag)
   {
     return [this](auto&& fn) { serial_channel.push(std::forward<decltype(fn)>(fn)); };
   }
 
+  auto operator()(event_sauce::concurrency::parallel_tag)
+  {
+    return [this](auto&& fn) {
+      using result_type = std::invoke_result_t<decltype(fn)>;
+      auto task = std::make_shared<boost::fibers::packaged_task<result_type()>>(std::forward<decltype(fn)>(fn));
+      auto future = task->get_future();
+      concurrent_channel.push([task] { (*task)(); });
+      return future;
+    };
+  }
+
+  // Makes fiber_worker::run() return once the tasks already in the channels have run. Pushing afterwards throws.
+  void close()
+  {
+    serial_channel.close();
+    concurrent_channel.close();
+  }
+
   channel_type serial_channel;
   channel_type concurrent_channel;
 };
 
+// fiber_worker :: runs a fiber_scheduler on the calling thread plus concurrent_workers - 1 helper threads
+//
+// All threads share boost::fibers::algo::work_stealing, and one consumer fiber per thread drains the concurrent
+// channel, so parallel tasks spread over every thread and migrate to whichever one is idle. The serial channel is
+// drained by the main fiber of the calling thread instead, which work stealing never migrates: serial tasks run in
+// order and always on the thread that called run(), which matters for e.g. an OpenGL context.
+//
+// run() returns once both channels are closed, see fiber_scheduler::close(). work_stealing keeps its schedulers in
+// static storage, so only one fiber_worker may run per process at a time.
 class fiber_worker
 {
 public:
   fiber_worker(fiber_scheduler& scheduler, int concurrent_workers)
       : scheduler{ scheduler }
-      , concurrent_workers{ concurrent_workers }
+      , concurrent_workers{ static_cast<std::uint32_t>(std::max(concurrent_workers, 1)) }
   {}
 
-  auto run()
+  void run()
   {
-    auto serial = boost::fibers::fiber([& channel = scheduler.serial_channel] {
-      fiber_scheduler::task_type task;
-      while (boost::fibers::channel_op_status::closed != channel.pop(task)) {
-        task();
-      }
-    });
-
-    auto concurrent = boost::fibers::fiber([& channel = scheduler.concurrent_channel] {
-      fiber_scheduler::task_type task;
-      while (boost::fibers::channel_op_status::closed != channel.pop(task)) {
-        task();
-      }
-    });
-
-    serial.join();
-    concurrent.join();
+    auto ready = boost::fibers::barrier{ concurrent_workers };
+    auto mutex = boost::fibers::mutex{};
+    auto finished = boost::fibers::condition_variable_any{};
+    auto done = false;
+
+    auto helpers = std::vector<std::thread>{};
+    for (auto i = std::uint32_t{ 1 }; i < concurrent_workers; ++i) {
+      helpers.emplace_back([&] {
+        boost::fibers::use_scheduling_algorithm<boost::fibers::algo::work_stealing>(concurrent_workers);
+        ready.wait();
+        // Parks the main fiber of the helper, its dispatcher keeps running the fibers it steals
+        auto lock = std::unique_lock{ mutex };
+        finished.wait(lock, [&] { return done; });
+      });
+    }
+    boost::fibers::use_scheduling_algorithm<boost::fibers::algo::work_stealing>(concurrent_workers);
+    ready.wait();
+
+    auto consumers = std::vector<boost::fibers::fiber>{};
+    for (auto i = std::uint32_t{ 0 }; i < concurrent_workers; ++i) {
+      consumers.emplace_back([&channel = scheduler.concurrent_channel] { drain(channel); });
+    }
+
+    drain(scheduler.serial_channel);
+
+    for (auto& consumer : consumers) {
+      consumer.join();
+    }
+    {
+      const auto lock = std::unique_lock{ mutex };
+      done = true;
+    }
+    finished.notify_all();
+    for (auto& helper : helpers) {
+      helper.join();
+    }
   }
 
 private:
+  static void drain(fiber_scheduler::channel_type& channel)
+  {
+    fiber_scheduler::task_type task;
+    while (boost::fibers::channel_op_status::closed != channel.pop(task)) {
+      task();
+    }
+  }
+
   fiber_scheduler& scheduler;
-  int concurrent_workers;
+  std::uint32_t concurrent_workers;
 };
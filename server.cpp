@@ -97,9 +97,7 @@ ClientAggregate::project(const ServerAggregate::Spoke& evt)
   };
 }
 
-namespace boost {
-namespace serialization {
-
+// Wire format of the events, found by argument dependent lookup
 template<class Archive>
 void
 serialize(Archive& ar, ServerAggregate::Spoke& evt, const unsigned int version)
@@ -114,9 +112,6 @@ serialize(Archive& ar, ClientAggregate::Spoke& evt, const unsigned int version)
   ar& evt.sentence;
 }
 
-} // namespace serialization
-} // namespace boost
-
 int
 main()
 {
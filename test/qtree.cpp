@@ -0,0 +1,216 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+#include "../common/flat_qtree.hpp"
+#include "../common/qtree.hpp"
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <vector>
+
+// Where every entity should be, with the entity of key i at positions[i] and a payload of 10 * i
+struct expectation
+{
+  std::vector<tensor<meter_t>> positions;
+  std::vector<bool> alive;
+
+  std::size_t size() const { return std::count(alive.begin(), alive.end(), true); }
+};
+
+template<typename Tree>
+Tree
+populated(expectation& expected, std::mt19937& rng, int count)
+{
+  auto coordinate = std::uniform_real_distribution<double>{ -1100, 1100 };
+  auto tree = Tree{};
+  for (auto key = 0; key < count; ++key) {
+    // A few entities are outside of the root, and a pile of them sits at the same point
+    const auto position = key % 50 == 0 ? tensor<meter_t>{ 1_m, 1_m }
+                                        : tensor<meter_t>{ meter_t{ coordinate(rng) }, meter_t{ coordinate(rng) } };
+    expected.positions.push_back(position);
+    expected.alive.push_back(true);
+    tree = insert(std::move(tree), key, key * 10, position);
+  }
+  return tree;
+}
+
+// Compares the tree with the expectation through every kind of lookup and query
+template<typename Tree>
+void
+check(const Tree& tree, const expectation& expected, std::mt19937& rng)
+{
+  REQUIRE(tree.size() == expected.size());
+  auto misplaced = 0;
+  for (auto key = 0; key < static_cast<int>(expected.positions.size()); ++key) {
+    const auto* entity = find(tree, key);
+    if (!expected.alive[key]) {
+      misplaced += entity != nullptr;
+    } else {
+      const auto& position = expected.positions[key];
+      misplaced += entity == nullptr || entity->payload != key * 10 || entity->position.x != position.x ||
+                   entity->position.y != position.y;
+    }
+  }
+  CHECK(misplaced == 0);
+
+  auto coordinate = std::uniform_real_distribution<double>{ -1100, 1100 };
+  for (auto q = 0; q < 20; ++q) {
+    const auto center = tensor<meter_t>{ meter_t{ coordinate(rng) }, meter_t{ coordinate(rng) } };
+    const auto range = typename Tree::BoundingBox{ center, 200_m };
+
+    auto in_range = std::vector<int>{};
+    auto distances = std::vector<double>{};
+    for (auto key = 0; key < static_cast<int>(expected.positions.size()); ++key) {
+      if (expected.alive[key]) {
+        if (range.contains(expected.positions[key])) {
+          in_range.push_back(key);
+        }
+        distances.push_back(detail::squared_distance(expected.positions[key], center));
+      }
+    }
+    std::sort(distances.begin(), distances.end());
+
+    auto found = std::vector<int>{};
+    for (const auto& entity : query(tree, range)) {
+      found.push_back(entity.key);
+    }
+    std::sort(found.begin(), found.end());
+    CHECK(found == in_range);
+
+    auto nearest_entities = std::vector<typename Tree::Entity>{};
+    nearest(tree, center, 5, std::back_inserter(nearest_entities));
+    auto nearest_distances = std::vector<double>{};
+    for (const auto& entity : nearest_entities) {
+      nearest_distances.push_back(detail::squared_distance(entity.position, center));
+    }
+    distances.resize(std::min<std::size_t>(5, distances.size()));
+    CHECK(nearest_distances == distances);
+  }
+
+  auto visited = std::size_t{ 0 };
+  visit(tree, [&visited](const auto&) { ++visited; });
+  CHECK(visited == expected.size());
+}
+
+// Small moves stay within the loose boundary or the leaf, large ones jump across the tree
+template<typename Tree>
+Tree
+moved(Tree tree, expectation& expected, std::mt19937& rng)
+{
+  auto coordinate = std::uniform_real_distribution<double>{ -1100, 1100 };
+  auto nudge = std::uniform_real_distribution<double>{ -5, 5 };
+  for (auto key = 0; key < static_cast<int>(expected.positions.size()); ++key) {
+    auto& position = expected.positions[key];
+    if (key % 3 == 0) {
+      position = { meter_t{ coordinate(rng) }, meter_t{ coordinate(rng) } };
+    } else {
+      position = { position.x + meter_t{ nudge(rng) }, position.y + meter_t{ nudge(rng) } };
+    }
+    tree = move(std::move(tree), key, position);
+  }
+  return tree;
+}
+
+template<typename Tree>
+Tree
+removed(Tree tree, expectation& expected)
+{
+  for (auto key = 0; key < static_cast<int>(expected.positions.size()); key += 2) {
+    expected.alive[key] = false;
+    tree = remove(std::move(tree), key);
+  }
+  return tree;
+}
+
+TEST_SUITE("quad trees")
+{
+  SCENARIO_TEMPLATE("keeping track of entities", Tree, quad_tree<int, int>, flat_quad_tree<int, int>)
+  {
+    GIVEN("a tree of entities spread over and beyond its boundary")
+    {
+      auto rng = std::mt19937{ 7 };
+      auto expected = expectation{};
+      auto tree = populated<Tree>(expected, rng, 500);
+      check(tree, expected, rng);
+
+      WHEN("an entity is inserted again under its key")
+      {
+        expected.positions[1] = { 3_m, 4_m };
+        tree = insert(std::move(tree), 1, 10, expected.positions[1]);
+        THEN("it should replace the entity with that key") { check(tree, expected, rng); }
+      }
+
+      WHEN("the entities are moved")
+      {
+        tree = moved(std::move(tree), expected, rng);
+        THEN("they should be found where they were moved to") { check(tree, expected, rng); }
+      }
+
+      WHEN("half of the entities are removed")
+      {
+        tree = removed(std::move(tree), expected);
+        THEN("only the others should be found") { check(tree, expected, rng); }
+      }
+
+      WHEN("a copy of the tree is changed")
+      {
+        const auto original = expected;
+        auto copy = tree;
+        auto changed = expected;
+        copy = moved(std::move(copy), changed, rng);
+        copy = removed(std::move(copy), changed);
+        THEN("the copy should have changed and the original should not")
+        {
+          check(copy, changed, rng);
+          check(tree, original, rng);
+        }
+      }
+    }
+  }
+
+  SCENARIO("compacting a flat quad tree")
+  {
+    GIVEN("a flat quad tree that has been split while it was changed")
+    {
+      auto rng = std::mt19937{ 11 };
+      auto expected = expectation{};
+      auto tree = populated<flat_quad_tree<int, int>>(expected, rng, 500);
+      tree = moved(std::move(tree), expected, rng);
+      tree = removed(std::move(tree), expected);
+
+      WHEN("it is compacted")
+      {
+        const auto compacted = tree.compacted();
+        THEN("it should hold the same entities in no more nodes, with no split left to compact")
+        {
+          check(compacted, expected, rng);
+          CHECK(compacted.node_count() <= tree.node_count());
+          CHECK(compacted.splits_since_compact == 0);
+        }
+        THEN("the children of every node should follow their parent, in Z order")
+        {
+          auto out_of_order = 0;
+          for (auto n = std::uint32_t{ 0 }; n < compacted.node_count(); ++n) {
+            const auto& node = compacted.node(n);
+            if (node.leaf()) {
+              continue;
+            }
+            out_of_order += node.first_child <= n;
+            for (auto q = 0; q < 4; ++q) {
+              const auto& child = compacted.node(node.first_child + q);
+              out_of_order += child.parent != n || node.boundary.quadrant_of(child.boundary.center) != q;
+            }
+          }
+          CHECK(out_of_order == 0);
+        }
+        THEN("changing a copy of it should leave it as it was")
+        {
+          const auto original = expected;
+          auto copy = compacted;
+          copy = moved(std::move(copy), expected, rng);
+          check(copy, expected, rng);
+          check(compacted, original, rng);
+        }
+      }
+    }
+  }
+}
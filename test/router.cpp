@@ -0,0 +1,156 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+#include "../networking/client.hpp"
+#include "../networking/router.hpp"
+#include <chrono>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <variant>
+#include <vector>
+
+struct Greeted
+{};
+
+template<class Archive>
+void
+serialize(Archive&, Greeted&, const unsigned int)
+{}
+
+struct Said
+{
+  int sequence = 0;
+};
+
+template<class Archive>
+void
+serialize(Archive& ar, Said& evt, const unsigned int)
+{
+  ar& evt.sequence;
+}
+
+using message_type = std::variant<Greeted, Said>;
+using client_type = Client<message_type>;
+
+// What a client has been sent, in the order it arrived
+struct inbox
+{
+  std::mutex key;
+  std::optional<std::string> greeted_by;
+  std::vector<int> said;
+
+  void operator()(std::string from, message_type message)
+  {
+    const auto lock = std::lock_guard{ key };
+    if (std::holds_alternative<Greeted>(message)) {
+      greeted_by = std::move(from);
+    } else {
+      said.push_back(std::get<Said>(message).sequence);
+    }
+  }
+
+  template<typename Predicate>
+  bool wait_for(Predicate predicate)
+  {
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds{ 10 };
+    while (std::chrono::steady_clock::now() < deadline) {
+      {
+        const auto lock = std::lock_guard{ key };
+        if (predicate(*this)) {
+          return true;
+        }
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds{ 1 });
+    }
+    return false;
+  }
+};
+
+// Starts a router that is never stopped; shards of 0 run the single-threaded event loop
+void
+start_router(const std::string& endpoint, std::size_t shards)
+{
+  std::thread{ [endpoint, shards] {
+    if (shards == 0) {
+      Router<message_type>::event_loop(endpoint);
+    } else {
+      Router<message_type>::sharded_event_loop(endpoint, shards);
+    }
+  } }.detach();
+}
+
+// Every third message of the sender is targetted at the receiver, the others are broadcast. Returns the sequence
+// numbers in the order the receiver got them.
+std::vector<int>
+interleaved(const std::string& endpoint, int count)
+{
+  auto received = inbox{};
+  auto receiver = client_type{ endpoint };
+  receiver.start([&received](std::string from, message_type message) { received(std::move(from), message); });
+
+  auto seen = inbox{};
+  auto sender = client_type{ endpoint };
+  sender.start([&seen](std::string from, message_type message) { seen(std::move(from), message); });
+
+  // The sender learns the identity of the receiver from a broadcast of it, repeated until the router knows the sender
+  if (!seen.wait_for([&receiver](const inbox& seen) {
+        if (!seen.greeted_by) {
+          receiver.publish(Greeted{});
+        }
+        return seen.greeted_by.has_value();
+      })) {
+    return {};
+  }
+  const auto receiver_identity = *seen.greeted_by;
+
+  for (auto sequence = 0; sequence < count; ++sequence) {
+    if (sequence % 3 == 2) {
+      sender.publish(Said{ sequence }, receiver_identity);
+    } else {
+      sender.publish(Said{ sequence });
+    }
+  }
+  received.wait_for([count](const inbox& received) { return static_cast<int>(received.said.size()) >= count; });
+
+  const auto lock = std::lock_guard{ received.key };
+  return received.said;
+}
+
+std::vector<int>
+sequence(int count)
+{
+  auto result = std::vector<int>(count);
+  for (auto i = 0; i < count; ++i) {
+    result[i] = i;
+  }
+  return result;
+}
+
+TEST_SUITE("router")
+{
+  SCENARIO("a client interleaving broadcasts and targetted messages")
+  {
+    static constexpr auto count = 3000;
+
+    GIVEN("the single-threaded router")
+    {
+      const auto endpoint = std::string{ "tcp://127.0.0.1:5700" };
+      start_router(endpoint, 0);
+      THEN("the receiver should get every message in the order it was sent")
+      {
+        CHECK(interleaved(endpoint, count) == sequence(count));
+      }
+    }
+
+    GIVEN("the sharded router")
+    {
+      const auto endpoint = std::string{ "tcp://127.0.0.1:5701" };
+      start_router(endpoint, 4);
+      THEN("the receiver should get every message in the order it was sent")
+      {
+        CHECK(interleaved(endpoint, count) == sequence(count));
+      }
+    }
+  }
+}
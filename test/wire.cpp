@@ -0,0 +1,205 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+#include "../networking/wire.hpp"
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <variant>
+#include <vector>
+
+struct Spoke
+{
+  std::string sentence;
+  std::optional<int> channel;
+};
+
+template<class Archive>
+void
+serialize(Archive& ar, Spoke& evt, const unsigned int)
+{
+  ar& evt.sentence& evt.channel;
+}
+
+enum class Heading : std::uint8_t
+{
+  north,
+  south
+};
+
+// No hook, copied as it is
+struct Point
+{
+  double x, y;
+};
+
+struct Moved
+{
+  int entity_id = 0;
+  Heading heading = Heading::north;
+  std::vector<Point> path;
+  std::vector<bool> flags;
+  std::vector<std::pair<int, std::string>> contacts;
+  std::tuple<std::uint16_t, float> extra;
+
+  template<typename Archive>
+  void serialize(Archive& ar, const unsigned int)
+  {
+    ar& entity_id& heading& path& flags& contacts& extra;
+  }
+};
+
+using message_type = std::variant<Spoke, Moved>;
+
+// The shape of event<message_type>::recv_type
+struct Received
+{
+  std::string from;
+  message_type message;
+
+  template<typename Archive>
+  void serialize(Archive& ar, const unsigned int)
+  {
+    ar& from& message;
+  }
+};
+
+std::vector<char>
+encoded(const Received& value)
+{
+  auto buffer = std::vector<char>(wire::encoded_size(value));
+  wire::encode(value, buffer.data());
+  return buffer;
+}
+
+template<typename T>
+std::optional<T>
+decoded(const std::vector<char>& buffer)
+{
+  return wire::decode<T>(buffer.data(), buffer.size());
+}
+
+const auto moved = Received{ "client-1",
+                             Moved{ 7,
+                                    Heading::south,
+                                    { { 1.5, -2.5 }, { 3.0, 4.0 } },
+                                    { true, false, true },
+                                    { { 7, "eight" }, { 9, "" } },
+                                    { 12, 0.5f } } };
+
+const auto spoke = Received{ "client-2", Spoke{ "Hello 42", 3 } };
+
+TEST_SUITE("wire codec")
+{
+  SCENARIO("round trips")
+  {
+    GIVEN("messages of every alternative")
+    {
+      const auto messages = { moved, spoke, Received{ "", Spoke{} } };
+
+      THEN("decoding them should give them back")
+      {
+        for (const auto& message : messages) {
+          const auto result = decoded<Received>(encoded(message));
+          REQUIRE(result);
+          CHECK(result->from == message.from);
+          REQUIRE(result->message.index() == message.message.index());
+          if (const auto* expected = std::get_if<Moved>(&message.message)) {
+            const auto& actual = std::get<Moved>(result->message);
+            CHECK(actual.entity_id == expected->entity_id);
+            CHECK(actual.heading == expected->heading);
+            REQUIRE(actual.path.size() == expected->path.size());
+            for (auto i = std::size_t{ 0 }; i < actual.path.size(); ++i) {
+              CHECK(actual.path[i].x == expected->path[i].x);
+              CHECK(actual.path[i].y == expected->path[i].y);
+            }
+            CHECK(actual.flags == expected->flags);
+            CHECK(actual.contacts == expected->contacts);
+            CHECK(actual.extra == expected->extra);
+          } else {
+            const auto& expected_spoke = std::get<Spoke>(message.message);
+            const auto& actual = std::get<Spoke>(result->message);
+            CHECK(actual.sentence == expected_spoke.sentence);
+            CHECK(actual.channel == expected_spoke.channel);
+          }
+        }
+      }
+    }
+
+    GIVEN("a message with an empty optional")
+    {
+      const auto buffer = encoded(Received{ "client-3", Spoke{ "Quiet", std::nullopt } });
+      THEN("it should stay empty")
+      {
+        const auto result = decoded<Received>(buffer);
+        REQUIRE(result);
+        CHECK(!std::get<Spoke>(result->message).channel);
+      }
+    }
+  }
+
+  SCENARIO("malformed input")
+  {
+    GIVEN("an encoded message")
+    {
+      const auto buffer = encoded(moved);
+
+      WHEN("it is cut short anywhere")
+      {
+        auto decodable = 0;
+        for (auto size = std::size_t{ 0 }; size < buffer.size(); ++size) {
+          decodable += wire::decode<Received>(buffer.data(), size).has_value();
+        }
+        THEN("no prefix should decode") { CHECK(decodable == 0); }
+      }
+
+      WHEN("bytes follow it")
+      {
+        auto longer = buffer;
+        longer.push_back(0);
+        THEN("it should not decode") { CHECK(!decoded<Received>(longer)); }
+      }
+
+      WHEN("the index of the alternative is out of range")
+      {
+        // The alternative follows the size and bytes of 'from'
+        auto corrupt = buffer;
+        corrupt[sizeof(std::uint32_t) + moved.from.size()] = 2;
+        THEN("it should not decode") { CHECK(!decoded<Received>(corrupt)); }
+      }
+    }
+
+    GIVEN("a size prefix far larger than the message")
+    {
+      auto corrupt = std::vector<char>(sizeof(std::uint32_t));
+      const auto size = std::uint32_t{ 0xffffffff };
+      std::memcpy(corrupt.data(), &size, sizeof(size));
+      corrupt.push_back('x');
+
+      THEN("strings and vectors of every kind should fail to decode instead of allocating it")
+      {
+        CHECK(!decoded<std::string>(corrupt));
+        CHECK(!decoded<std::vector<int>>(corrupt));
+        CHECK(!decoded<std::vector<bool>>(corrupt));
+        CHECK(!decoded<std::vector<std::string>>(corrupt));
+      }
+    }
+
+    GIVEN("a bool that is neither 0 nor 1")
+    {
+      const auto corrupt = std::vector<char>{ 2 };
+      THEN("it should not decode") { CHECK(!decoded<bool>(corrupt)); }
+    }
+
+    GIVEN("an empty buffer")
+    {
+      THEN("nothing should decode from it")
+      {
+        CHECK(!wire::decode<Received>(nullptr, 0));
+        CHECK(!wire::decode<int>(nullptr, 0));
+      }
+    }
+  }
+}